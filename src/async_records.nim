@@ -0,0 +1,95 @@
+## Flood control for async notifications.
+##
+## Thread pools and programs with many shared objects produce bursts of
+## `=thread-created`, `=thread-exited`, `=library-loaded` and
+## `=breakpoint-modified` records. They are held for a short window and
+## collapsed to their final state before reaching the IDE: a thread created
+## and exited (or a library loaded and unloaded) inside the window is never
+## shown, and only the last `=breakpoint-modified` per breakpoint survives.
+## Any other record flushes the window first, so ordering relative to stops
+## and results is preserved.
+
+import std/[tables, monotimes, times, strutils, algorithm]
+import mi_parser
+
+const MaxHeld = 10_000
+
+type
+  AsyncRecords* = ref object
+    emit: proc(line: string) {.closure.}  # to the IDE, before output transformation
+    window: Duration                      # zero disables holding
+    held: seq[string]                     # in arrival order; "" once collapsed away
+    index: Table[string, int]             # "thread:N", "lib:ID", "bkpt:N" -> position in `held`
+    openedAt: MonoTime
+    suppressed*: CountTable[string]       # record class -> records never shown
+
+proc newAsyncRecords*(emit: proc(line: string) {.closure.}, windowMs: int = 50): AsyncRecords =
+  new(result)
+  result.emit = emit
+  result.window = initDuration(milliseconds = windowMs)
+  result.index = initTable[string, int]()
+  result.suppressed = initCountTable[string]()
+
+proc flush*(ar: AsyncRecords) =
+  for line in ar.held:
+    if line.len > 0: ar.emit(line)
+  ar.held.setLen(0)
+  ar.index.clear()
+
+proc tick*(ar: AsyncRecords) =
+  ## Releases the window once it has been open long enough
+  if ar.held.len > 0 and getMonoTime() - ar.openedAt >= ar.window:
+    ar.flush()
+
+proc hold(ar: AsyncRecords, key, line: string) =
+  if ar.held.len == 0: ar.openedAt = getMonoTime()
+  ar.index[key] = ar.held.len
+  ar.held.add(line)
+  if ar.held.len >= MaxHeld: ar.flush()
+
+proc cancel(ar: AsyncRecords, key, recordClass: string) =
+  ## Drops a held record together with the one undoing it
+  ar.held[ar.index[key]] = ""
+  ar.index.del(key)
+  ar.suppressed.inc(recordClass, 2)
+
+proc observe*(ar: AsyncRecords, line: string): bool =
+  ## True if `line` was held back; otherwise held records have been released
+  ## and the caller forwards `line` as usual
+  if ar.window == DurationZero: return false
+  if line.startsWith("~") or line.startsWith("@") or line.startsWith("&") or line == "(gdb)":
+    return false  # stream output may interleave freely
+
+  let comma = line.find(',')
+  let recordClass = if comma == -1: line else: line[0 ..< comma]
+  case recordClass
+  of "=thread-created":
+    ar.hold("thread:" & miField(line, "id"), line)
+  of "=thread-exited":
+    let key = "thread:" & miField(line, "id")
+    if ar.index.hasKey(key): ar.cancel(key, "thread")
+    else: ar.hold(key, line)
+  of "=library-loaded":
+    ar.hold("lib:" & miField(line, "id"), line)
+  of "=library-unloaded":
+    let key = "lib:" & miField(line, "id")
+    if ar.index.hasKey(key): ar.cancel(key, "library")
+    else: ar.hold(key, line)
+  of "=breakpoint-modified":
+    let key = "bkpt:" & miField(line, "number")
+    if ar.index.hasKey(key):
+      ar.held[ar.index[key]] = line  # keep the latest state in the earlier slot
+      ar.suppressed.inc("breakpoint-modified")
+    else:
+      ar.hold(key, line)
+  else:
+    ar.flush()
+    return false
+  return true
+
+proc summary*(ar: AsyncRecords): string =
+  var parts: seq[string] = @[]
+  for recordClass, count in ar.suppressed:
+    parts.add(recordClass & "=" & $count)
+  parts.sort()
+  return "Async records suppressed: " & (if parts.len > 0: parts.join(", ") else: "none")
@@ -0,0 +1,133 @@
+## Breakpoint locations remembered across launches.
+##
+## Resolving a `file:line` or function linespec makes GDB search the whole
+## binary, so an IDE that restores a few hundred breakpoints at launch waits
+## seconds for it. The proxy records the address of each single-location
+## breakpoint from its `^done,bkpt={...}` reply, in a file keyed by the
+## binary's build-id. On the next launch of the same build, the insert is sent
+## as `*ADDRESS`, which GDB places without a search. Entries are keyed on the
+## location as the IDE wrote it, before any name mangling, and
+## `original-location` in the replies is set back to it. Explicit locations
+## (`--source`, `--line`, `--function`, `--label`) are not cached.
+##
+## Only position-dependent executables (ELF type EXEC) are cached. Before the
+## first run GDB reports a PIE's addresses unrelocated (`0x1136`), and a
+## `*0x1136` breakpoint stays at that address once the program is loaded.
+
+import std/[os, osproc, strutils, tables]
+import mi_parser, build_id
+
+type
+  BreakpointCache* = ref object
+    path: string                      # "" disables the cache
+    resolved: Table[string, string]   # location -> address
+    learning: Table[string, string]   # IDE token -> location, for inserts GDB resolves itself
+    rewritten: Table[string, string]  # IDE token -> location, for inserts sent by address
+    byAddress: Table[string, string]  # address -> location, for restoring original-location
+    dirty: bool
+    hits*: int
+    learned*: int
+
+proc isFixedAddress*(elfHeader: string): bool =
+  ## Whether `readelf -h` output describes an executable loaded at its link
+  ## address (EXEC), as opposed to a PIE or shared object (DYN)
+  for line in elfHeader.splitLines:
+    let parts = line.strip().splitWhitespace()
+    if parts.len >= 2 and parts[0] == "Type:":
+      return parts[1] == "EXEC"
+  return false
+
+proc breakpointCachePath*(binaryPath: string): string =
+  ## The cache file for `binaryPath`, or "" when its addresses are not stable
+  let (header, code) = execCmdEx("readelf -h " & quoteShell(binaryPath) & " 2>/dev/null")
+  if code != 0 or not isFixedAddress(header): return ""
+  let id = buildId(binaryPath)
+  if id.len == 0: return ""
+  return cacheDir("breakpoints") / (id & ".tsv")
+
+proc newBreakpointCache*(path: string): BreakpointCache =
+  new(result)
+  result.path = path
+  result.resolved = initTable[string, string]()
+  result.learning = initTable[string, string]()
+  result.rewritten = initTable[string, string]()
+  result.byAddress = initTable[string, string]()
+  if path.len > 0 and fileExists(path):
+    for line in lines(path):
+      let tab = line.rfind('\t')
+      if tab > 0:
+        result.resolved[line[0 ..< tab]] = line[tab + 1 .. ^1]
+
+proc save*(bc: BreakpointCache) =
+  if not bc.dirty or bc.path.len == 0: return
+  var f = open(bc.path & ".tmp", fmWrite)
+  for location, address in bc.resolved:
+    f.write(location & "\t" & address & "\n")
+  f.close()
+  moveFile(bc.path & ".tmp", bc.path)
+  bc.dirty = false
+
+proc rewrite*(bc: BreakpointCache, ideLine, line: string): string =
+  ## `line`, the debugger's form of the IDE's `ideLine`, sent by address
+  ## instead when the IDE's location is cached
+  if bc.path.len == 0 or not stripToken(ideLine).startsWith("-break-insert"): return line
+  let token = miToken(line)
+  let args = miArgs(stripToken(ideLine))
+  if token.len == 0 or args.len < 2: return line
+  for arg in args:
+    if arg in ["--source", "--line", "--function", "--label"]: return line
+  let location = args[^1]
+  if location.startsWith("*") or location.startsWith("-"): return line
+
+  let parts = line.splitWhitespace()
+  let raw = parts[^1]
+  if raw.startsWith("\"") != raw.endsWith("\""):
+    return line  # a quoted location with spaces
+  let address = bc.resolved.getOrDefault(location)
+  if address.len == 0:
+    bc.learning[token] = location
+    return line
+  inc bc.hits
+  bc.rewritten[token] = location
+  bc.byAddress[address] = location
+  return parts[0 ..< parts.len - 1].join(" ") & " *" & address
+
+proc restoreLocations(bc: BreakpointCache, line: string): string =
+  result = line
+  var start = 0
+  while true:
+    let b = findField(result, "original-location", start)
+    if b.first == -1: return
+    start = b.last
+    let value = result[b.first ..< b.last]
+    if value.startsWith("*") and bc.byAddress.hasKey(value[1 .. ^1]):
+      let location = escapeMi(bc.byAddress[value[1 .. ^1]])
+      result = result[0 ..< b.first] & location & result[b.last .. ^1]
+      start = b.first + location.len
+
+proc observe*(bc: BreakpointCache, line: string): string =
+  ## Learns addresses from insert replies and restores the IDE's locations
+  if bc.path.len == 0: return line
+  if line.startsWith("*running"):
+    bc.save()  # the launch's inserts are done
+    return line
+
+  if isResultRecord(line):
+    let token = miToken(line)
+    var location: string
+    if bc.learning.pop(token, location):
+      let address = miField(line, "addr")
+      # <MULTIPLE> and <PENDING> locations cannot be replaced by one address
+      if not isErrorRecord(line) and address.startsWith("0x"):
+        bc.resolved[location] = address
+        bc.dirty = true
+        inc bc.learned
+    elif bc.rewritten.pop(token, location):
+      if isErrorRecord(line):
+        # The cached address is stale; resolve it normally next launch
+        bc.resolved.del(location)
+        bc.dirty = true
+
+  if bc.byAddress.len > 0 and "original-location=\"*" in line:
+    return bc.restoreLocations(line)
+  return line
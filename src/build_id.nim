@@ -0,0 +1,104 @@
+## Build identity of a binary, used to key caches across sessions, and the
+## directories those caches and the daemons' sockets live in.
+##
+## The GNU build-id note when the binary has one; otherwise a hash of the
+## path, size and modification time, which changes whenever the file does.
+
+import std/[os, osproc, strutils, hashes, times]
+
+when defined(posix):
+  import std/posix
+
+when defined(linux):
+  type PeerCred = object  # struct ucred, which glibc only declares under _GNU_SOURCE
+    pid: int32
+    uid: uint32
+    gid: uint32
+  var SO_PEERCRED {.importc, header: "<sys/socket.h>".}: cint
+  proc getgrouplist(user: cstring, group: Gid, groups: ptr Gid, ngroups: var cint): cint
+    {.importc, header: "<grp.h>".}
+
+proc buildId*(binaryPath: string): string =
+  ## Lowercase hex build-id, or "" if the file does not exist
+  if not fileExists(binaryPath): return ""
+  try:
+    let (output, code) = execCmdEx("readelf -n " & quoteShell(binaryPath) & " 2>/dev/null")
+    if code == 0:
+      for line in output.splitLines:
+        let at = line.find("Build ID:")
+        if at >= 0:
+          return line[at + "Build ID:".len .. ^1].strip().toLowerAscii()
+  except OSError:
+    discard
+  let info = getFileInfo(absolutePath(binaryPath))
+  let h = hash(absolutePath(binaryPath) & "|" & $info.size & "|" & $info.lastWriteTime.toUnix)
+  return "path-" & toHex(h, 16).toLowerAscii()
+
+proc cacheDir*(kind: string): string =
+  ## Per-user cache directory for `kind` ("symbols", "gdb-index", ...), created on demand
+  result = getCacheDir() / "nim_debugger_mi" / kind
+  createDir(result)
+
+proc runtimeDir*(): string =
+  ## Per-user directory for the daemons' default sockets, created on demand
+  ## with mode 0700. Raises OSError when it exists but another user owns it or
+  ## could write into it, since a socket there could have been planted.
+  when defined(posix):
+    result = getTempDir() / ("nim_debugger_mi-" & $getuid())
+    discard mkdir(cstring(result), 0o700)
+    var st: Stat
+    if lstat(cstring(result), st) != 0 or not S_ISDIR(st.st_mode) or st.st_uid != getuid() or
+       (st.st_mode.int and 0o077) != 0:
+      raise newException(OSError, "refusing to use " & result & ": not a private directory of this user")
+  else:
+    result = getTempDir() / ("nim_debugger_mi-" & getEnv("USERNAME", "user"))
+    createDir(result)
+
+proc trustedSocket*(path: string): bool =
+  ## True if `path` is a socket that no other user can have put there: ours,
+  ## or owned by the owner of a directory that is not world-writable (a
+  ## group-shared service directory)
+  when defined(posix):
+    var st, dir: Stat
+    if lstat(cstring(path), st) != 0 or not S_ISSOCK(st.st_mode): return false
+    if st.st_uid == getuid(): return true
+    if stat(cstring(path.parentDir), dir) != 0: return false
+    return st.st_uid == dir.st_uid and (dir.st_mode.int and 0o002) == 0
+  else:
+    return fileExists(path)
+
+proc shareSocket*(path: string) =
+  ## Lets the group of the socket's directory connect; the directory's own
+  ## permissions decide who that is
+  when defined(posix):
+    discard chmod(cstring(path), 0o660)
+
+proc peerUid*(fd: SocketHandle): int =
+  ## Uid of the process at the other end of a Unix socket, or -1 if unknown
+  when defined(linux):
+    var cred: PeerCred
+    var size = sizeof(cred).SockLen
+    if getsockopt(fd, SOL_SOCKET, SO_PEERCRED, addr cred, addr size) != 0: return -1
+    return cred.uid.int
+  else:
+    return -1
+
+proc allowedPeer*(fd: SocketHandle, socketPath: string): bool =
+  ## Whether the client on `fd` may use the service at `socketPath`: our own
+  ## user, or, for a socket in a group-shared directory, members of its group
+  when defined(linux):
+    let uid = peerUid(fd)
+    if uid < 0: return false
+    if uid == getuid().int: return true
+    var dir: Stat
+    if stat(cstring(socketPath.parentDir), dir) != 0 or (dir.st_mode.int and 0o070) == 0: return false
+    let pw = getpwuid(Uid(uid))
+    if pw == nil: return false
+    var groups: array[256, Gid]
+    var count = groups.len.cint
+    if getgrouplist(pw.pw_name, pw.pw_gid, addr groups[0], count) < 0: return false
+    for i in 0 ..< count:
+      if groups[i] == dir.st_gid: return true
+    return false
+  else:
+    return false
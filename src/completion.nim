@@ -0,0 +1,141 @@
+## Debug-console completion answered by the proxy.
+##
+## `-complete "p myV"` is served from a prefix trie over demangled global
+## names plus the current frame's locals (ranked first), so completion shows
+## Nim names and never walks GDB's symbol tables.
+
+import std/[tables, strutils, algorithm]
+import symbol_map, mi_parser
+
+const
+  MaxCompletions* = 200  # GDB's default max-completions
+  # Commands whose arguments are expressions or linespecs; the completions of
+  # everything else (`info lo`, `set pri`, `help`) are GDB's own keywords
+  ExpressionCommands = ["print", "p", "call", "display", "x", "watch", "break", "b", "tbreak", "until", "u"]
+
+type
+  TrieNode = object
+    children: seq[tuple[ch: char, node: int32]]  # sorted by ch
+    terminal: bool
+
+  PrefixTrie* = object
+    nodes: seq[TrieNode]
+    count*: int
+
+  Completer* = ref object
+    sm: SymbolMap
+    globals: PrefixTrie
+    indexedGeneration: int  # SymbolMap.generation when `globals` was built
+
+proc initPrefixTrie*(): PrefixTrie =
+  result.nodes = @[TrieNode()]
+
+proc child(t: PrefixTrie, node: int, ch: char): int =
+  for c in t.nodes[node].children:
+    if c.ch == ch: return c.node.int
+  return -1
+
+proc insert*(t: var PrefixTrie, word: string) =
+  var node = 0
+  for ch in word:
+    var next = t.child(node, ch)
+    if next == -1:
+      next = t.nodes.len
+      t.nodes.add(TrieNode())
+      t.nodes[node].children.add((ch, next.int32))
+      t.nodes[node].children.sort(proc(a, b: tuple[ch: char, node: int32]): int = cmp(a.ch, b.ch))
+    node = next
+  if not t.nodes[node].terminal:
+    t.nodes[node].terminal = true
+    inc t.count
+
+proc collect(t: PrefixTrie, node: int, word: var string, limit: int, found: var seq[string]) =
+  if found.len >= limit: return
+  if t.nodes[node].terminal:
+    found.add(word)
+  for c in t.nodes[node].children:
+    word.add(c.ch)
+    t.collect(c.node.int, word, limit, found)
+    word.setLen(word.len - 1)
+
+proc withPrefix*(t: PrefixTrie, prefix: string, limit: int): seq[string] =
+  ## Up to `limit` words starting with `prefix`, in lexical order
+  var node = 0
+  for ch in prefix:
+    node = t.child(node, ch)
+    if node == -1: return @[]
+  var word = prefix
+  t.collect(node, word, limit, result)
+
+proc newCompleter*(sm: SymbolMap): Completer =
+  new(result)
+  result.sm = sm
+  result.globals = initPrefixTrie()
+  result.indexedGeneration = -1
+
+proc refresh(c: Completer) =
+  ## Rebuilds the global trie after symbols were (re)loaded
+  if c.indexedGeneration == c.sm.generation: return
+  c.globals = initPrefixTrie()
+  for name in c.sm.globalDemangledToMangled.keys:
+    c.globals.insert(name)
+  c.indexedGeneration = c.sm.generation
+
+proc candidates*(c: Completer, prefix: string, limit: int = MaxCompletions): seq[string] =
+  ## Locals of the current frame first, then globals
+  var locals: seq[string] = @[]
+  for name in c.sm.localDemangledToMangled.keys:
+    if name.startsWith(prefix) and not name.startsWith("["):
+      locals.add(name)
+  locals.sort()
+  result = locals
+  if result.len >= limit:
+    result.setLen(limit)
+    return
+  c.refresh()
+  for name in c.globals.withPrefix(prefix, limit):
+    if result.len >= limit: break
+    if name notin locals:
+      result.add(name)
+
+proc complete*(c: Completer, line: string): string =
+  ## MI reply for a `-complete` command, or "" when GDB should answer it
+  ## (command names, non-expression commands, member access and anything
+  ## that is not an identifier)
+  let command = stripToken(line)
+  if not command.startsWith("-complete "): return ""
+  var text = command["-complete ".len .. ^1].strip()
+  if text.len >= 2 and text[0] == '"' and text[^1] == '"':
+    text = unescapeMi(text[1 .. ^2])
+
+  let space = text.rfind(' ')
+  if space == -1: return ""
+  if text.split({' ', '/'}, maxsplit = 1)[0] notin ExpressionCommands: return ""
+  var start = text.len
+  while start > space + 1 and text[start-1] in IdentChars:
+    dec start
+  if start != space + 1: return ""  # not a bare identifier, e.g. `obj.fi`
+  let prefix = text[start .. ^1]
+  if prefix.len > 0 and prefix[0] notin IdentStartChars: return ""
+
+  let names = c.candidates(prefix, MaxCompletions + 1)
+  let reached = names.len > MaxCompletions
+  var matches: seq[string] = @[]
+  var common = ""
+  for i, name in names:
+    if i >= MaxCompletions: break
+    let full = text[0 ..< start] & name
+    matches.add("\"" & escapeMi(full) & "\"")
+    if i == 0:
+      common = full
+    else:
+      var n = 0
+      while n < common.len and n < full.len and common[n] == full[n]:
+        inc n
+      common.setLen(n)
+
+  result = miToken(line) & "^done"
+  if matches.len > 0:
+    result.add(",completion=\"" & escapeMi(common) & "\"")
+  result.add(",matches=[" & matches.join(",") & "]")
+  result.add(",max_completions_reached=\"" & (if reached: "1" else: "0") & "\"")
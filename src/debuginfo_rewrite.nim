@@ -0,0 +1,168 @@
+## Nim names baked into DWARF.
+##
+## `nim_debugger_mi rewrite-debuginfo --binary=X` writes a separate debug file
+## for X in which the `DW_AT_name` of Nim procs, variables and parameters is
+## the demangled Nim name (`SymbolMap.demangle`). GDB started with that file
+## as its symbol file shows Nim names by itself. The proxy detects the file
+## and asks GDB for the renamed globals by their Nim names (listed next to it in
+## `<file>.renamed`); names that stayed mangled are still transformed.
+##
+## Names are rewritten in place in `.debug_str`, so every DIE offset stays
+## valid: a demangled name is never longer than its mangled one, and the rest
+## of the string is padded with NULs. Names stored inline in `.debug_info`,
+## names that would grow (`[StackFrame]`), and strings whose tail is shared
+## with another name by the linker's string merging are left mangled.
+## `.gdb_index` and `.debug_names` hash the old names, so they are dropped.
+
+import std/[os, osproc, strutils, tables, algorithm, memfiles]
+import symbol_map, build_id
+
+const RenamedTags = ["DW_TAG_subprogram", "DW_TAG_variable", "DW_TAG_formal_parameter"]
+
+type
+  NameRef* = object
+    offset*: int  # into .debug_str
+    name*: string
+    tag*: string
+
+proc companionPath*(binaryPath: string): string =
+  ## The rewritten debug file for `binaryPath`, keyed by build-id
+  let id = buildId(binaryPath)
+  if id.len == 0: return ""
+  return cacheDir("debuginfo") / (id & ".debug")
+
+proc renamedListPath*(companion: string): string =
+  ## Mangled names whose DWARF name `companion` rewrote, one per line
+  return companion & ".renamed"
+
+proc collectNameRefs*(dump: string): tuple[names: seq[NameRef], referenced: seq[int]] =
+  ## `DW_AT_name`s of renamed DIEs in `readelf --debug-dump=info` output, and
+  ## every .debug_str offset any attribute refers to
+  var tag = ""
+  for rawLine in dump.splitLines:
+    let line = rawLine.strip(trailing = false)
+    if not line.startsWith("<"): continue
+    if "Abbrev Number" in line:
+      let tagStart = line.find("(DW_TAG_")
+      tag = if tagStart >= 0: line[tagStart + 1 ..< line.len - 1] else: ""
+      continue
+    let indirect = line.find("(indirect string, offset: 0x")
+    if indirect < 0: continue
+    let close = line.find("): ", indirect)
+    if close < 0: continue
+    var offset: int
+    try:
+      offset = parseHexInt(line[indirect + "(indirect string, offset: ".len ..< close])
+    except ValueError:
+      continue
+    result.referenced.add(offset)
+    if tag in RenamedTags and line.find("DW_AT_name") in 0 ..< indirect:
+      result.names.add(NameRef(offset: offset, name: line[close + 3 .. ^1], tag: tag))
+
+proc planRewrites*(sm: SymbolMap, names: seq[NameRef], referenced: seq[int]): seq[(int, string)] =
+  ## (offset, new name) pairs that are safe to write over .debug_str
+  let shared = referenced.sorted()
+  var seen = initTable[int, bool]()
+  for r in names:
+    if seen.hasKey(r.offset): continue
+    seen[r.offset] = true
+    let demangled = if r.tag == "DW_TAG_subprogram": sm.globalMangledToDemangled.getOrDefault(r.name, sm.demangle(r.name))
+                    else: sm.demangle(r.name)
+    if demangled == r.name or demangled.len == 0 or demangled.len > r.name.len or demangled[0] == '[':
+      continue
+    # Another reference into this string's tail would see the padding
+    let next = shared.upperBound(r.offset)
+    if next < shared.len and shared[next] <= r.offset + r.name.len:
+      continue
+    result.add((r.offset, demangled))
+
+proc applyRewrites*(data: ptr UncheckedArray[char], sectionStart: int, names: Table[int, string],
+                    rewrites: seq[(int, string)]): seq[string] =
+  ## Writes each rewrite whose original bytes are where the dump said; returns
+  ## the original names that were written over
+  for (offset, demangled) in rewrites:
+    let original = names[offset]
+    let at = sectionStart + offset
+    var matches = data[at + original.len] == '\0'
+    for i in 0 ..< original.len:
+      if not matches: break
+      matches = data[at + i] == original[i]
+    if not matches: continue
+    for i in 0 ..< original.len:
+      data[at + i] = if i < demangled.len: demangled[i] else: '\0'
+    result.add(original)
+
+proc sectionRange(path, name: string): tuple[offset, size: int, compressed: bool] =
+  ## File offset and size of section `name`, from `readelf -S -W`
+  result = (-1, 0, false)
+  let (output, code) = execCmdEx("readelf -S -W " & quoteShell(path) & " 2>/dev/null")
+  if code != 0: return
+  for line in output.splitLines:
+    let close = line.find(']')
+    if close < 0 or not line.strip().startsWith("["): continue
+    # [Nr] Name Type Address Off Size ES Flg Lk Inf Al
+    let parts = line[close + 1 .. ^1].splitWhitespace()
+    if parts.len >= 7 and parts[0] == name:
+      try:
+        result = (parseHexInt(parts[3]), parseHexInt(parts[4]), 'C' in parts[6])
+      except ValueError:
+        discard
+      return
+
+proc rewriteDebuginfo*(binaryPath, output: string): tuple[renamed, names: int] =
+  let sm = newSymbolMap()
+  if not sm.loadFromBinary(binaryPath):
+    raise newException(IOError, "could not read symbols of " & binaryPath)
+  let work = output & ".tmp"
+  if execCmd("objcopy --only-keep-debug --decompress-debug-sections --remove-section=.gdb_index " &
+             "--remove-section=.debug_names " & quoteShell(binaryPath) & " " & quoteShell(work)) != 0:
+    raise newException(IOError, "objcopy failed on " & binaryPath)
+  defer:
+    if fileExists(work): removeFile(work)
+  let (dump, code) = execCmdEx("readelf --wide --debug-dump=info " & quoteShell(work) & " 2>/dev/null")
+  if code != 0: raise newException(IOError, "no DWARF in " & binaryPath)
+  let section = sectionRange(work, ".debug_str")
+  if section.offset < 0 or section.compressed:
+    raise newException(IOError, "no uncompressed .debug_str in " & binaryPath)
+
+  let (names, referenced) = collectNameRefs(dump)
+  var byOffset = initTable[int, string]()
+  for r in names:
+    byOffset[r.offset] = r.name
+  var rewrites: seq[(int, string)] = @[]
+  for (offset, demangled) in planRewrites(sm, names, referenced):
+    if offset + byOffset[offset].len < section.size:
+      rewrites.add((offset, demangled))
+
+  var mf = memfiles.open(work, mode = fmReadWrite)
+  let renamed = applyRewrites(cast[ptr UncheckedArray[char]](mf.mem), section.offset, byOffset, rewrites)
+  result.renamed = renamed.len
+  result.names = byOffset.len
+  mf.close()
+  writeFile(renamedListPath(output), renamed.join("\n") & "\n")
+  moveFile(work, output)
+
+proc runRewriteDebuginfo*(args: seq[string]): int =
+  let quotes = {'"', '\'', ' ', '`'}
+  var binary, output = ""
+  for arg in args:
+    if arg.startswith("--binary=") or arg.startswith("--binary:"):
+      binary = arg[9 .. ^1].strip(chars = quotes).expandTilde
+    elif arg.startswith("--output=") or arg.startswith("--output:"):
+      output = arg[9 .. ^1].strip(chars = quotes).expandTilde
+    elif not arg.startsWith("--") and binary.len == 0:
+      binary = arg.expandTilde
+    else:
+      stderr.writeLine("Invalid rewrite-debuginfo argument: " & arg)
+      return 1
+  if binary.len == 0 or not fileExists(binary):
+    stderr.writeLine("Usage: nim_debugger_mi rewrite-debuginfo --binary=<program> [--output=file.debug]")
+    return 1
+  if output.len == 0: output = companionPath(binary)
+  try:
+    let (renamed, names) = rewriteDebuginfo(binary, output)
+    stderr.writeLine("Renamed " & $renamed & " of " & $names & " DWARF names; wrote " & output)
+    return 0
+  except IOError as e:
+    stderr.writeLine("rewrite-debuginfo: " & e.msg)
+    return 1
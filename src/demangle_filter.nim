@@ -0,0 +1,116 @@
+## Streaming demangle filter for text that never passes through a live session:
+## CI GDB logs, saved `bt full` dumps, sanitizer and perf output.
+##
+## `nim_debugger_mi --filter --binary X < in.log > out.log` scans stdin in
+## large chunks, replaces every recognized mangled identifier and writes the
+## result to stdout. Plain text is copied through in bulk, and each distinct
+## token is demangled only once.
+
+import std/[tables, strutils]
+import symbol_map, mi_transformer
+
+const
+  ChunkSize = 1 shl 20
+  MemoLimit = 1 shl 20  # distinct tokens remembered before the memo is reset
+
+type
+  DemangleFilter* = object
+    sm: SymbolMap
+    memo: Table[string, string]
+
+proc initDemangleFilter*(sm: SymbolMap): DemangleFilter =
+  result.sm = sm
+  result.memo = initTable[string, string]()
+
+proc addRange(dst: var string, src: string, first, last: int) =
+  ## dst.add(src[first ..< last]) without the temporary
+  let n = last - first
+  if n <= 0: return
+  let old = dst.len
+  dst.setLen(old + n)
+  copyMem(dst[old].addr, src[first].unsafeAddr, n)
+
+proc recognize(f: DemangleFilter, token: string): string =
+  ## Demangled spelling of `token`, or `token` itself if it is not a symbol
+  ## we recognize. Ordinary identifiers are left alone, so `i_1` in prose
+  ## only changes when the binary actually defines it.
+  if f.sm.globalMangledToDemangled.hasKey(token):
+    return f.sm.globalMangledToDemangled[token]
+  if token.startsWith("_Z"):
+    return demangleName(f.sm, token)
+  if token.find("__") > 0:
+    return f.sm.demangle(token)
+  return token
+
+proc scan*(f: var DemangleFilter, data: string, eof: bool, output: var string): int =
+  ## Appends the filtered form of `data` to `output` and returns how many
+  ## bytes were consumed. Unless `eof` is set, an identifier touching the end
+  ## of `data` is left unconsumed because it may continue in the next chunk.
+  var i = 0
+  var plainStart = 0
+  while i < data.len:
+    let c = data[i]
+    if c in IdentChars:
+      var j = i + 1
+      var underscore = c == '_'
+      while j < data.len and data[j] in IdentChars:
+        if data[j] == '_': underscore = true
+        inc j
+      if j == data.len and not eof:
+        break
+      # Numbers with identifier tails (0x7f_..., 12ab) are skipped as a whole
+      if underscore and c in IdentStartChars:
+        let token = data[i ..< j]
+        var demangled = f.memo.getOrDefault(token, "")
+        if demangled.len == 0:
+          demangled = f.recognize(token)
+          if f.memo.len >= MemoLimit: f.memo.clear()
+          f.memo[token] = demangled
+        if demangled != token:
+          output.addRange(data, plainStart, i)
+          output.add(demangled)
+          plainStart = j
+      i = j
+    else:
+      inc i
+  output.addRange(data, plainStart, i)
+  return i
+
+proc filterText*(sm: SymbolMap, text: string): string =
+  var f = initDemangleFilter(sm)
+  discard f.scan(text, true, result)
+
+proc filterStream*(sm: SymbolMap, input, output: File) =
+  var f = initDemangleFilter(sm)
+  var data = ""
+  var outBuf = newStringOfCap(ChunkSize * 2)
+  while true:
+    # Unconsumed bytes from the previous chunk stay at the front of `data`
+    let keep = data.len
+    data.setLen(keep + ChunkSize)
+    let n = input.readBuffer(data[keep].addr, ChunkSize)
+    data.setLen(keep + n)
+    let eof = n < ChunkSize
+
+    let consumed = f.scan(data, eof, outBuf)
+    let rest = data.len - consumed
+    if rest > 0:
+      moveMem(data[0].addr, data[consumed].addr, rest)
+    data.setLen(rest)
+
+    if outBuf.len >= ChunkSize or eof:
+      output.write(outBuf)
+      outBuf.setLen(0)
+    if eof: break
+  output.flushFile()
+
+proc runFilter*(programPath, symbolsPath: string): int =
+  let sm = newSymbolMap()
+  if symbolsPath != "":
+    discard sm.loadFromFile(symbolsPath)
+  elif programPath != "":
+    if not sm.loadFromBinary(programPath):
+      stderr.writeLine("Failed to load symbols from: " & programPath)
+      return 1
+  filterStream(sm, stdin, stdout)
+  return 0
@@ -0,0 +1,159 @@
+## Function breakpoints on Nim procs across overloads and generic instantiations.
+##
+## A single Nim proc such as `process` may exist as many C functions
+## (`process__modA_u12`, `process__modB_u98`, ...). GDB's -break-insert takes
+## one location, so the IDE's breakpoint is placed on the first instantiation
+## and the proxy inserts hidden breakpoints for the rest. Hits, deletes,
+## enables, disables and conditions are kept in step with the IDE's breakpoint
+## number, so together they behave as one multi-location breakpoint. Logpoints
+## (`-dprintf-insert`) on a proc are expanded the same way.
+
+import std/[tables, strutils, re]
+import symbol_map, mi_parser, mi_transformer, internal_commands
+
+type
+  FunctionBreakpoints* = ref object
+    sm: SymbolMap
+    commands: InternalCommands
+    transform: InputTransformer
+    pending: Table[string, seq[string]]  # IDE token -> hidden inserts to send once its breakpoint exists
+    hidden: Table[string, seq[string]]   # IDE breakpoint number -> hidden breakpoint numbers
+    owner: Table[string, string]         # hidden breakpoint number -> IDE breakpoint number
+
+# "process" or "modA.process"
+let reProcName = re"^[a-zA-Z_][a-zA-Z0-9_]*(\.[a-zA-Z_][a-zA-Z0-9_]*)?$"
+
+proc newFunctionBreakpoints*(sm: SymbolMap, commands: InternalCommands,
+                             transform: InputTransformer = inputTransformer(dkGdb)): FunctionBreakpoints =
+  new(result)
+  result.sm = sm
+  result.commands = commands
+  result.transform = transform
+  result.pending = initTable[string, seq[string]]()
+  result.hidden = initTable[string, seq[string]]()
+  result.owner = initTable[string, string]()
+
+proc skipValue(line: string, i: int): int =
+  ## Index just past the MI value starting at `i`, quoted or bare
+  result = i
+  if result < line.len and line[result] == '"':
+    inc result
+    while result < line.len and line[result] != '"':
+      if line[result] == '\\': inc result
+      inc result
+    inc result
+  else:
+    while result < line.len and line[result] notin Whitespace: inc result
+
+proc dprintfLocation(line: string): Slice[int] =
+  ## Bounds of the location in a `-dprintf-insert` line, or an empty slice
+  result = 1 .. 0
+  var i = line.find("-dprintf-insert")
+  if i < 0: return
+  i += "-dprintf-insert".len
+  while true:
+    while i < line.len and line[i] in Whitespace: inc i
+    if i >= line.len: return
+    let last = skipValue(line, i)
+    if line[i] != '-':
+      return i ..< last
+    let option = line[i ..< last]
+    i = last
+    if option in ["-c", "-i", "-p"]:
+      while i < line.len and line[i] in Whitespace: inc i
+      i = skipValue(line, i)
+
+proc expandInsert*(fb: FunctionBreakpoints, line: string): string =
+  ## Points a function -break-insert or -dprintf-insert on a Nim proc name at
+  ## its first instantiation and queues the others. Other lines are returned
+  ## unchanged.
+  let command = stripToken(line)
+  var location: Slice[int]
+  if command.startsWith("-break-insert"):
+    let start = line.rfind(' ') + 1
+    if start == 0: return line
+    location = start ..< line.len
+  elif command.startsWith("-dprintf-insert"):
+    location = dprintfLocation(line)
+    if location.len == 0: return line
+  else:
+    return line
+  let name = line[location].strip(chars = {'"'})
+  if not name.match(reProcName): return line
+
+  let instances = fb.sm.procInstances(name)
+  if instances.len == 0: return line
+
+  let (prefix, suffix) = (line[0 ..< location.a], line[location.b + 1 .. ^1])
+  let token = miToken(line)
+  if instances.len > 1 and token.len > 0:
+    var extra: seq[string] = @[]
+    for mangled in instances[1 .. ^1]:
+      extra.add(stripToken(prefix) & mangled & suffix)
+    fb.pending[token] = extra
+  return prefix & instances[0] & suffix
+
+proc observe*(fb: FunctionBreakpoints, line: string): string =
+  ## Rewrites debugger output that mentions hidden breakpoints so the IDE only
+  ## sees its own breakpoint numbers. Returns "" for lines the IDE must not see.
+  if fb.pending.len > 0 and isResultRecord(line):
+    let token = miToken(line)
+    if fb.pending.hasKey(token):
+      let extra = fb.pending[token]
+      fb.pending.del(token)
+      let number = miField(line, "number")
+      if isErrorRecord(line) or number.len == 0:
+        return line
+      for cmd in extra:
+        discard fb.commands.send(fb.transform(cmd, fb.sm, false), proc(reply: string) =
+          let hiddenNumber = miField(reply, "number")
+          if not isErrorRecord(reply) and hiddenNumber.len > 0:
+            fb.hidden.mgetOrPut(number, @[]).add(hiddenNumber)
+            fb.owner[hiddenNumber] = number
+        )
+      return line
+
+  if fb.owner.len == 0: return line
+
+  if line.startsWith("*stopped"):
+    let b = findField(line, "bkptno")
+    if b.first != -1:
+      let number = line[b.first ..< b.last]
+      if fb.owner.hasKey(number):
+        return line[0 ..< b.first] & fb.owner[number] & line[b.last .. ^1]
+  elif line.startsWith("=breakpoint-modified") or line.startsWith("=breakpoint-deleted"):
+    if fb.owner.hasKey(miField(line, "number")) or fb.owner.hasKey(miField(line, "id")):
+      return ""
+  return line
+
+proc mirror*(fb: FunctionBreakpoints, line: string) =
+  ## Applies breakpoint commands the IDE sends for one of its breakpoints to
+  ## the hidden breakpoints behind it
+  if fb.hidden.len == 0: return
+  let parts = stripToken(line).splitWhitespace()
+  if parts.len < 2: return
+
+  case parts[0]
+  of "-break-delete", "-break-enable", "-break-disable":
+    var targets: seq[string] = @[]
+    for number in parts[1 .. ^1]:
+      targets.add(fb.hidden.getOrDefault(number, @[]))
+    if targets.len == 0: return
+    discard fb.commands.send(parts[0] & " " & targets.join(" "))
+    if parts[0] == "-break-delete":
+      for number in parts[1 .. ^1]:
+        for h in fb.hidden.getOrDefault(number, @[]):
+          fb.owner.del(h)
+        fb.hidden.del(number)
+  of "-break-condition", "-break-after":
+    # "-break-condition [--force] N expr", "-break-after N count"
+    var i = 1
+    while i < parts.len and parts[i].startsWith("-"):
+      inc i
+    if i >= parts.len: return
+    let flags = parts[1 ..< i]
+    let rest = parts[i+1 .. ^1].join(" ")
+    for h in fb.hidden.getOrDefault(parts[i], @[]):
+      discard fb.commands.send((@[parts[0]] & flags & @[h, rest]).join(" ").strip())
+  else:
+    discard
@@ -0,0 +1,109 @@
+## Cached GDB symbol indexes.
+##
+## Without `.gdb_index` or `.debug_names`, GDB builds its own symbol index from
+## the full DWARF at every start. On large `--debugger:native` binaries, that
+## is most of the launch time. With `--gdb-index`, when the binary has DWARF
+## but no index, the proxy writes an indexed copy of its debug info
+## (`objcopy --only-keep-debug`) to the user cache directory, keyed by
+## build-id, in a background process. On later launches GDB executes the
+## original and reads symbols from the copy (`--exec`/`--symbols`).
+##
+## A lock directory next to the copy keeps concurrent launches from building
+## it twice. The least recently used copies are evicted once the cache grows
+## past `MaxCacheBytes`.
+
+import std/[os, osproc, strutils, times, algorithm]
+import build_id
+
+const
+  MaxCacheBytes* = 2'i64 * 1024 * 1024 * 1024
+  StaleLockAfter = initDuration(hours = 1)  # a build killed midway leaves its lock behind
+
+type
+  IndexState* = enum
+    isNoDebugInfo  ## nothing to index
+    isIndexed      ## the binary carries .gdb_index or .debug_names
+    isCached       ## an indexed copy is in the cache
+    isMissing      ## DWARF without an index
+
+proc indexedCopyPath*(binaryPath: string): string =
+  let id = buildId(binaryPath)
+  if id.len == 0: return ""
+  return cacheDir("gdb-index") / (id & ".debug")
+
+proc lockPath(copy: string): string =
+  return copy & ".lock"
+
+proc indexState*(binaryPath: string): IndexState =
+  let (sections, code) = execCmdEx("readelf -S -W " & quoteShell(binaryPath) & " 2>/dev/null")
+  if code != 0 or ".debug_info" notin sections: return isNoDebugInfo
+  if ".gdb_index" in sections or ".debug_names" in sections: return isIndexed
+  if fileExists(indexedCopyPath(binaryPath)): return isCached
+  return isMissing
+
+proc indexCommand*(binaryPath, gdbPath: string): string =
+  ## Shell command that writes the indexed copy: gdb-add-index when
+  ## installed, otherwise `save gdb-index` plus objcopy. Nothing happens while
+  ## another build holds the lock; the copy is renamed into place only when
+  ## complete.
+  let final = indexedCopyPath(binaryPath)
+  let work = final & ".tmp"
+  let (w, g, lock) = (quoteShell(work), quoteShell(gdbPath), quoteShell(lockPath(final)))
+  let addIndex = "gdb-add-index " & w & " || { " & g & " -batch -nx -ex " &
+                 quoteShell("save gdb-index " & work.parentDir) & " " & w & " && " &
+                 "objcopy --add-section .gdb_index=" & quoteShell(work & ".gdb_index") &
+                 " --set-section-flags .gdb_index=readonly " & w & " " & w & "; }"
+  return "{ mkdir " & lock & " && { objcopy --only-keep-debug " & quoteShell(binaryPath) & " " & w &
+         " && { " & addIndex & "; } && mv " & w & " " & quoteShell(final) & "; rm -f " & w & " " &
+         quoteShell(work & ".gdb_index") & "; rmdir " & lock & "; }; } >/dev/null 2>&1"
+
+proc evictIndexedCopies*(maxBytes: int64 = MaxCacheBytes) =
+  ## Removes the least recently used copies until the cache fits `maxBytes`
+  var copies: seq[tuple[used: Time, path: string, size: int64]] = @[]
+  for path in walkFiles(cacheDir("gdb-index") / "*.debug"):
+    try:
+      let info = getFileInfo(path)
+      copies.add((info.lastWriteTime, path, info.size.int64))
+    except OSError:
+      discard
+  copies.sort(proc(a, b: tuple[used: Time, path: string, size: int64]): int = cmp(b.used, a.used))
+  var total = 0'i64
+  for copy in copies:
+    total += copy.size
+    if total > maxBytes:
+      discard tryRemoveFile(copy.path)
+
+proc generateIndexInBackground*(binaryPath, gdbPath: string): bool =
+  ## Starts the index build for the next launch; false if it could not start
+  ## or another launch is already building it
+  when defined(posix):
+    let lock = lockPath(indexedCopyPath(binaryPath))
+    if dirExists(lock):
+      if getTime() - getLastModificationTime(lock) < StaleLockAfter: return false
+      removeDir(lock)
+    evictIndexedCopies()
+    try:
+      # Not waited for: the build may outlive this session
+      discard startProcess(indexCommand(binaryPath, gdbPath), options = {poEvalCommand})
+      return true
+    except OSError:
+      return false
+  else:
+    return false
+
+proc useSymbolFile*(gdbArgs: seq[string], binaryPath, symbolFile: string): seq[string] =
+  ## `gdbArgs` with the program replaced by `--exec=PROGRAM --symbols=FILE`
+  for arg in gdbArgs:
+    if arg == binaryPath:
+      result.add("--exec=" & binaryPath)
+      result.add("--symbols=" & symbolFile)
+    else:
+      result.add(arg)
+
+proc useIndexedCopy*(gdbArgs: seq[string], binaryPath: string): seq[string] =
+  let copy = indexedCopyPath(binaryPath)
+  try:
+    setLastModificationTime(copy, getTime())  # recently used, for eviction
+  except OSError:
+    discard
+  return useSymbolFile(gdbArgs, binaryPath, copy)
@@ -0,0 +1,321 @@
+## Pre-warmed GDB for the edit-build-debug loop.
+##
+## `nim_debugger_mi gdb-pool --binary=X` keeps a GDB running with X already
+## loaded (`-file-exec-and-symbols`), and loads it again whenever X is
+## rebuilt (inotify on its directory). A session started with `--gdb-pool`
+## runs `nim_debugger_mi gdb-attach` in place of GDB. The relay claims the warm
+## GDB over a Unix socket and copies bytes both ways. If no warm GDB matches
+## the session's binary, the relay execs a normal GDB instead. Each warm GDB
+## serves one session; the pool starts the next one as soon as it is claimed.
+## GDB loads in the background of the pool's poll loop, so a rebuild does not
+## hold up claims; a claim made meanwhile is answered once loading finishes.
+##
+## A claimed GDB can run shell commands as the pool's user, so the socket is
+## mode 0600 and connections from any other uid (SO_PEERCRED) are refused.
+##
+## The session is told about the handover with a `=nim-debugger-warm` record
+## ahead of GDB's replayed startup output. The proxy swallows that record and
+## answers the IDE's `-file-exec-and-symbols` for the same binary itself.
+
+import std/[os, osproc, strutils, monotimes, times]
+import mi_parser, build_id
+
+when defined(posix):
+  import std/[net, posix]
+when defined(linux):
+  import std/inotify
+
+const
+  WarmMarker* = "=nim-debugger-warm"
+  RewarmQuietMs = 300  # the linker writes in several steps; wait for it to finish
+
+type
+  GdbPoolOptions = object
+    socketPath: string
+    gdbPath: string
+    binary: string
+
+  WarmStage = enum
+    wsStopped
+    wsStarting  # reading GDB's startup records
+    wsLoading   # -file-exec-and-symbols sent
+    wsReady
+    wsFailed
+
+  WarmGdb = object
+    pid: int
+    input, output: cint   # GDB's stdin and stdout
+    banner: seq[string]   # startup records before the first prompt, replayed to the session
+    buffer: string        # GDB output not split into lines yet
+    stage: WarmStage
+    loaded: bool
+    started: MonoTime
+    modified: Time        # of the binary when it was loaded
+
+proc defaultPoolSocket*(): string =
+  return runtimeDir() / "gdb-pool.sock"
+
+proc warmMarker*(binary: string): string =
+  return WarmMarker & ",binary=\"" & escapeMi(binary) & "\""
+
+when defined(posix):
+  proc writeAll(fd: cint, data: string): bool =
+    var sent = 0
+    while sent < data.len:
+      let n = posix.write(fd, unsafeAddr data[sent], data.len - sent)
+      if n <= 0: return false
+      sent += n
+    return true
+
+  proc relay(readA, writeA, readB, writeB: cint) =
+    ## Copies A's input to B and B's input to A until either side closes
+    var fds = [TPollfd(fd: readA, events: POLLIN), TPollfd(fd: readB, events: POLLIN)]
+    let targets = [writeB, writeA]
+    var chunk: array[65536, char]
+    while true:
+      if poll(addr fds[0], Tnfds(2), -1) < 0:
+        if errno == EINTR: continue
+        return
+      for i in 0 .. 1:
+        if (fds[i].revents and (POLLIN or POLLHUP or POLLERR)) != 0:
+          let n = posix.read(fds[i].fd, addr chunk[0], chunk.len)
+          if n <= 0: return
+          var data = newString(n)
+          copyMem(addr data[0], addr chunk[0], n)
+          if not writeAll(targets[i], data): return
+
+  proc stop(gdb: var WarmGdb) =
+    if gdb.pid > 0:
+      discard posix.kill(Pid(gdb.pid), SIGKILL)
+      discard posix.close(gdb.input)
+      discard posix.close(gdb.output)
+    gdb = WarmGdb()
+
+  proc fail(gdb: var WarmGdb) =
+    gdb.stop()
+    gdb.stage = wsFailed
+
+  proc startWarm(opts: GdbPoolOptions): WarmGdb =
+    ## Starts a GDB; `advance` loads the binary as its output arrives, so
+    ## claims and rebuilds are still served meanwhile
+    result.started = getMonoTime()
+    result.modified = getLastModificationTime(opts.binary)
+    let log = cacheDir("gdb-pool") / "gdb.log"
+    let process = startProcess("exec " & quoteShell(opts.gdbPath) & " --interpreter=mi -q 2>>" & quoteShell(log),
+                               options = {poEvalCommand})
+    result.pid = process.processID
+    result.input = process.inputHandle.cint
+    result.output = process.outputHandle.cint
+    result.stage = wsStarting
+
+  proc warming(gdb: WarmGdb): bool =
+    return gdb.stage in {wsStarting, wsLoading}
+
+  proc advance(gdb: var WarmGdb, opts: GdbPoolOptions) =
+    ## Consumes what the warming GDB wrote; called when its output is readable
+    var chunk: array[4096, char]
+    let n = posix.read(gdb.output, addr chunk[0], chunk.len)
+    if n <= 0:
+      stderr.writeLine("GDB pool: GDB exited while loading " & opts.binary)
+      gdb.fail()
+      return
+    let start = gdb.buffer.len
+    gdb.buffer.setLen(start + n)
+    copyMem(addr gdb.buffer[start], addr chunk[0], n)
+    while gdb.warming:
+      let nl = gdb.buffer.find('\n')
+      if nl < 0: return
+      let line = gdb.buffer[0 ..< nl].strip(leading = false)
+      gdb.buffer = gdb.buffer[nl + 1 .. ^1]
+      if gdb.stage == wsStarting:
+        if line != "(gdb)":
+          gdb.banner.add(line)
+        elif writeAll(gdb.input, "-file-exec-and-symbols \"" & escapeMi(opts.binary) & "\"\n"):
+          gdb.stage = wsLoading
+        else:
+          gdb.fail()
+      elif line.startsWith("^done"):
+        gdb.loaded = true
+      elif line.startsWith("^error"):
+        stderr.writeLine("GDB pool: could not load " & opts.binary & ": " & miField(line, "msg"))
+      elif line == "(gdb)":
+        if not gdb.loaded:
+          gdb.fail()
+          return
+        gdb.stage = wsReady
+        stderr.writeLine("GDB pool: warmed " & opts.binary & " in " &
+                         $(getMonoTime() - gdb.started).inMilliseconds & " ms")
+
+  proc alive(gdb: WarmGdb): bool =
+    return gdb.stage == wsReady and posix.kill(Pid(gdb.pid), 0) == 0
+
+  proc handOver(gdb: WarmGdb, client: Socket, binary: string) =
+    ## In a forked child: replays GDB's startup to the session and relays
+    ## until either side goes away
+    let fd = client.getFd.cint
+    var startup = warmMarker(binary) & "\n"
+    for line in gdb.banner:
+      startup.add(line & "\n")
+    startup.add("(gdb)\n")
+    if writeAll(fd, startup):
+      relay(fd, fd, gdb.output, gdb.input)
+    discard posix.kill(Pid(gdb.pid), SIGKILL)
+    exitnow(0)  # never return into the pool loop or run its cleanup
+
+  proc claim(gdb: var WarmGdb, server, client: Socket, opts: GdbPoolOptions) =
+    ## Hands the ready GDB to `client` and starts warming the next one
+    try:
+      client.send("OK\n")
+    except OSError:
+      client.close()
+      return
+    if fork() == 0:
+      server.close()
+      gdb.handOver(client, opts.binary)
+    # The child owns this GDB now
+    discard posix.close(gdb.input)
+    discard posix.close(gdb.output)
+    client.close()
+    gdb = startWarm(opts)
+
+  proc refuse(client: Socket, reason: string) =
+    try:
+      client.send("ERR " & reason & "\n")
+    except OSError:
+      discard
+    client.close()
+
+proc parsePoolArgs(args: seq[string]): GdbPoolOptions =
+  let quotes = {'"', '\'', ' ', '`'}
+  result.gdbPath = findExe("gdb")
+  for arg in args:
+    if arg.startswith("--socket=") or arg.startswith("--socket:"):
+      result.socketPath = arg[9 .. ^1].strip(chars = quotes).expandTilde
+    elif arg.startswith("--gdb=") or arg.startswith("--gdb:"):
+      result.gdbPath = arg[6 .. ^1].strip(chars = quotes).expandTilde
+    elif arg.startswith("--binary=") or arg.startswith("--binary:"):
+      result.binary = absolutePath(arg[9 .. ^1].strip(chars = quotes).expandTilde)
+    else:
+      raise newException(ValueError, arg)
+
+proc runGdbPool*(args: seq[string]): int =
+  var opts: GdbPoolOptions
+  try:
+    opts = parsePoolArgs(args)
+    if opts.socketPath.len == 0: opts.socketPath = defaultPoolSocket()
+  except ValueError as e:
+    stderr.writeLine("Invalid gdb-pool argument: " & e.msg)
+    return 1
+  except OSError as e:
+    stderr.writeLine("GDB pool: " & e.msg)
+    return 1
+  if opts.binary.len == 0 or opts.gdbPath.len == 0:
+    stderr.writeLine("Usage: nim_debugger_mi gdb-pool --binary=<program> [--gdb=PATH] [--socket=PATH]")
+    return 1
+  when defined(linux):
+    signal(SIGCHLD, SIG_IGN)  # relays and killed GDBs are reaped by the kernel
+    if fileExists(opts.socketPath) or symlinkExists(opts.socketPath):
+      removeFile(opts.socketPath)
+    var server = newSocket(AF_UNIX, SOCK_STREAM, IPPROTO_IP)
+    defer:
+      server.close()
+      removeFile(opts.socketPath)
+    server.bindUnix(opts.socketPath)
+    # A claimed GDB runs shell commands as this user: never share it
+    discard chmod(cstring(opts.socketPath), 0o600)
+    server.listen()
+
+    let watch = inotify_init()
+    if watch < 0 or inotify_add_watch(watch, cstring(opts.binary.parentDir),
+                                      IN_CLOSE_WRITE or IN_MOVED_TO) < 0:
+      stderr.writeLine("GDB pool: inotify unavailable; rebuilds are picked up on the next claim")
+    stderr.writeLine("GDB pool listening on " & opts.socketPath)
+
+    var gdb = startWarm(opts)
+    var waiting: seq[Socket] = @[]  # claims made while the GDB was still loading
+    var changedAt = MonoTime()
+    var changed = false
+    var events: array[4096, byte]
+    var fds = [TPollfd(fd: server.getFd.cint, events: POLLIN), TPollfd(fd: watch.cint, events: POLLIN),
+               TPollfd(fd: -1, events: POLLIN)]
+    while true:
+      fds[2].fd = if gdb.warming: gdb.output else: -1
+      discard poll(addr fds[0], Tnfds(3), 100)  # negative descriptors are ignored
+
+      if watch >= 0 and (fds[1].revents and POLLIN) != 0:
+        let n = posix.read(watch, addr events[0], events.len)
+        if n > 0:
+          for event in inotify_events(addr events[0], n):
+            if $cast[cstring](addr event.name) == opts.binary.extractFilename:
+              changed = true
+              changedAt = getMonoTime()
+      if changed and getMonoTime() - changedAt >= initDuration(milliseconds = RewarmQuietMs):
+        changed = false
+        gdb.stop()
+        gdb = startWarm(opts)
+
+      if fds[2].fd >= 0 and (fds[2].revents and (POLLIN or POLLHUP or POLLERR)) != 0:
+        gdb.advance(opts)
+      if waiting.len > 0 and not gdb.warming:
+        if gdb.stage == wsReady:
+          let client = waiting[0]
+          waiting.delete(0)
+          gdb.claim(server, client, opts)
+        else:
+          for client in waiting:
+            client.refuse("warm-up failed")
+          waiting.setLen(0)
+
+      if (fds[0].revents and POLLIN) == 0: continue
+      var client: Socket
+      try:
+        new(client)
+        server.accept(client)
+      except OSError:
+        continue
+      if peerUid(client.getFd) != getuid().int:
+        client.refuse("not the pool's user")
+        continue
+      try:
+        let request = client.recvLine(timeout = 5_000).strip()
+        if not request.startsWith("ATTACH ") or request[7 .. ^1] != opts.binary:
+          client.refuse("not warm for this binary")
+        elif gdb.alive and getLastModificationTime(opts.binary) == gdb.modified:
+          gdb.claim(server, client, opts)
+        else:
+          if not gdb.warming:
+            gdb.stop()
+            gdb = startWarm(opts)
+          waiting.add(client)  # answered once the GDB is loaded
+      except OSError, TimeoutError:
+        client.close()
+  else:
+    stderr.writeLine("The GDB pool needs Linux (inotify and Unix domain sockets)")
+    return 1
+
+proc runGdbAttach*(args: seq[string]): int =
+  ## `gdb-attach SOCKET BINARY GDB [GDB ARGS...]`: relays stdin/stdout to a
+  ## warm GDB from the pool, or becomes GDB itself when none is available
+  if args.len < 3:
+    stderr.writeLine("Usage: nim_debugger_mi gdb-attach <socket> <binary> <gdb> [gdb args...]")
+    return 1
+  when defined(posix):
+    if trustedSocket(args[0]):
+      var socket = newSocket(AF_UNIX, SOCK_STREAM, IPPROTO_IP)
+      try:
+        socket.connectUnix(args[0])
+        socket.send("ATTACH " & args[1] & "\n")
+        if socket.recvLine(timeout = 30_000) == "OK":
+          let fd = socket.getFd.cint
+          relay(STDIN_FILENO, STDOUT_FILENO, fd, fd)
+          socket.close()
+          return 0
+      except OSError, TimeoutError:
+        discard
+      socket.close()
+    let argv = allocCStringArray(args[2 .. ^1])
+    discard execv(cstring(args[2]), argv)
+    stderr.writeLine("Could not start " & args[2] & ": " & osErrorMsg(osLastError()))
+    return 1
+  else:
+    return execCmd(quoteShellCommand(args[2 .. ^1]))
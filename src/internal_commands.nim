@@ -0,0 +1,53 @@
+## Commands the proxy sends to the debugger on its own behalf.
+##
+## They carry tokens from a reserved range so that their result records (and
+## the prompt that follows each one) are routed back to the proxy instead of
+## reaching the IDE.
+
+import tables
+import mi_parser
+
+const InternalTokenBase* = 900_000_000
+
+type
+  ReplyHandler* = proc(reply: string) {.closure.}
+
+  InternalCommands* = ref object
+    nextToken: int
+    handlers: Table[string, ReplyHandler]
+    promptsToSwallow: int
+    writer: proc(line: string) {.closure.}
+
+proc newInternalCommands*(writer: proc(line: string) {.closure.}): InternalCommands =
+  new(result)
+  result.nextToken = InternalTokenBase
+  result.handlers = initTable[string, ReplyHandler]()
+  result.writer = writer
+
+proc send*(self: InternalCommands, command: string, handler: ReplyHandler = nil): string =
+  ## Sends `command` (without token) to the debugger and returns the token used
+  inc self.nextToken
+  result = $self.nextToken
+  self.handlers[result] = handler
+  self.writer(result & command)
+
+proc pending*(self: InternalCommands): int =
+  return self.handlers.len
+
+proc handleReply*(self: InternalCommands, line: string): bool =
+  ## Returns true if `line` belongs to an internal command and must not be
+  ## forwarded to the IDE. The command's handler runs before returning.
+  if line == "(gdb)" and self.promptsToSwallow > 0:
+    dec self.promptsToSwallow
+    return true
+
+  let token = miToken(line)
+  if token.len == 0 or not isResultRecord(line) or not self.handlers.hasKey(token):
+    return false
+
+  let handler = self.handlers[token]
+  self.handlers.del(token)
+  inc self.promptsToSwallow
+  if handler != nil:
+    handler(line)
+  return true
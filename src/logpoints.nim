@@ -0,0 +1,176 @@
+## Logpoints on Nim code through GDB `dprintf`.
+##
+## `-dprintf-insert` and the console `dprintf LOCATION,"format",args...` are
+## written with Nim names. Arguments and conditions go through the expression
+## transformer, so GDB evaluates them without the IDE ever seeing a stop; proc
+## locations are left for `FunctionBreakpoints.expandInsert`, which logs every
+## instantiation. Console records printed by an inserted format while the
+## inferior runs are buffered, demangled, and released as one stream record
+## per batch, instead of one record per hit. Other program output passes
+## through as it arrives.
+
+import std/[strutils, monotimes, times, re]
+import symbol_map, mi_parser, mi_transformer, demangle_filter
+
+const MaxBatchBytes = 64 * 1024
+
+type
+  Logpoints* = ref object
+    sm: SymbolMap
+    transform: ExpressionTransformer
+    formats: seq[Regex]                   # console text each inserted format prints
+    emit: proc(line: string) {.closure.}  # to the IDE, already transformed
+    window: Duration
+    running: bool
+    buffer: string                        # unescaped console text of the current batch
+    openedAt: MonoTime
+    inserted*: int
+    batches*: int
+    records*: int
+
+proc newLogpoints*(sm: SymbolMap, emit: proc(line: string) {.closure.}, windowMs: int = 100,
+                   transform: ExpressionTransformer = expressionTransformer(dkGdb)): Logpoints =
+  new(result)
+  result.sm = sm
+  result.transform = transform
+  result.emit = emit
+  result.window = initDuration(milliseconds = windowMs)
+
+proc quoteMi(s: string): string =
+  return "\"" & escapeMi(s) & "\""
+
+proc formatPattern(format: string): Regex =
+  ## Matches the console text printed by a dprintf with the C string `format`
+  var pattern = "(?s)^"
+  var i = 0
+  while i < format.len:
+    var c = format[i]
+    if c == '\\' and i + 1 < format.len:
+      inc i
+      c = case format[i]
+          of 'n': '\n'
+          of 't': '\t'
+          else: format[i]
+    elif c == '%' and i + 1 < format.len and format[i+1] != '%':
+      inc i
+      while i < format.len and format[i] in {'-', '+', ' ', '#', '.', '*', '0'..'9', 'h', 'l', 'L', 'q', 'j', 'z', 't'}:
+        inc i
+      pattern.add(".*?")
+      inc i
+      continue
+    elif c == '%':
+      inc i
+    pattern.add(escapeRe($c))
+    inc i
+  return re(pattern & "$")
+
+proc splitTopLevel(s: string): seq[string] =
+  ## Splits `loc,"fmt, with commas",f(a, b)` on commas outside quotes and parens
+  var depth = 0
+  var inString = false
+  var current = ""
+  var i = 0
+  while i < s.len:
+    let c = s[i]
+    if inString:
+      current.add(c)
+      if c == '\\' and i + 1 < s.len:
+        current.add(s[i+1])
+        inc i
+      elif c == '"':
+        inString = false
+    elif c == '"':
+      inString = true
+      current.add(c)
+    elif c in {'(', '['}:
+      inc depth
+      current.add(c)
+    elif c in {')', ']'}:
+      dec depth
+      current.add(c)
+    elif c == ',' and depth == 0:
+      result.add(current.strip())
+      current = ""
+    else:
+      current.add(c)
+    inc i
+  if current.strip().len > 0:
+    result.add(current.strip())
+
+proc build(lp: Logpoints, token: string, options: seq[string], loc, format: string, args: seq[string]): string =
+  inc lp.inserted
+  lp.formats.add(formatPattern(format))
+  var parts = @["-dprintf-insert"] & options & @[loc, quoteMi(format)]
+  for arg in args:
+    parts.add(quoteMi(lp.transform(arg, lp.sm)))
+  return token & parts.join(" ")
+
+proc rewrite*(lp: Logpoints, line: string): string =
+  ## `-dprintf-insert` with C names, or `line` unchanged if it is not a logpoint
+  let token = miToken(line)
+  let args = miArgs(stripToken(line))
+  if args.len == 0: return line
+
+  if args[0] == "-dprintf-insert":
+    # -dprintf-insert [-t] [-f] [-d] [--qualified] [-c cond] [-i count] [-p thread] location format args...
+    var options: seq[string] = @[]
+    var i = 1
+    while i < args.len and args[i].startsWith("-"):
+      if args[i] in ["-c", "-i", "-p"] and i + 1 < args.len:
+        let value = if args[i] == "-c": lp.transform(args[i+1], lp.sm) else: args[i+1]
+        options.add(args[i] & " " & quoteMi(value))
+        i += 2
+      else:
+        options.add(args[i])
+        inc i
+    if args.len - i < 2: return line
+    return lp.build(token, options, args[i], args[i+1], args[i+2 .. ^1])
+
+  if args[0] == "-interpreter-exec" and args.len == 3 and args[1] == "console":
+    let console = args[2].strip()
+    if not console.startsWith("dprintf "): return line
+    let pieces = splitTopLevel(console["dprintf ".len .. ^1])
+    if pieces.len < 2 or not (pieces[1].len >= 2 and pieces[1][0] == '"' and pieces[1][^1] == '"'):
+      return line
+    # The console format is a C string; keep its escapes for GDB to interpret
+    return lp.build(token, @[], pieces[0], pieces[1][1 .. ^2].replace("\\\"", "\""), pieces[2 .. ^1])
+
+  return line
+
+proc flush*(lp: Logpoints) =
+  if lp.buffer.len == 0: return
+  lp.emit("~" & quoteMi(filterText(lp.sm, lp.buffer)))
+  lp.buffer.setLen(0)
+  inc lp.batches
+
+proc tick*(lp: Logpoints) =
+  if lp.buffer.len > 0 and getMonoTime() - lp.openedAt >= lp.window:
+    lp.flush()
+
+proc printedByLogpoint(lp: Logpoints, text: string): bool =
+  for format in lp.formats:
+    if text.match(format): return true
+  return false
+
+proc observe*(lp: Logpoints, line: string): bool =
+  ## True if `line` is logpoint output that was added to the current batch
+  if line.startsWith("*running"):
+    lp.running = true
+  elif line.startsWith("*stopped"):
+    lp.running = false
+
+  let text = if lp.running and lp.inserted > 0 and line.startsWith("~\""):
+               unescapeMi(line[2 ..< line.len - 1])
+             else: ""
+  if text.len == 0 or not lp.printedByLogpoint(text):
+    # Stops, results and other console output end the batch so nothing is
+    # reordered; notifications and prompts do not
+    if line.startsWith("*") or line.startsWith("^") or line.startsWith("~") or
+       miToken(line).len > 0 or not lp.running:
+      lp.flush()
+    return false
+  if lp.buffer.len == 0: lp.openedAt = getMonoTime()
+  lp.buffer.add(text)
+  inc lp.records
+  if lp.buffer.len >= MaxBatchBytes: lp.flush()
+  return true
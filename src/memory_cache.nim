@@ -0,0 +1,163 @@
+## Page-granular cache for `-data-read-memory-bytes`.
+##
+## Memory and hex views send overlapping reads as the user scrolls. While the
+## inferior stays stopped, memory can only change through the debugger, so
+## reads are served from 4 KiB pages cached for the current stop. Missing pages
+## are fetched with one read per run of adjacent pages. Resumes, stops and
+## commands that can write memory drop the cache.
+
+import std/[tables, strutils]
+import mi_parser, internal_commands
+
+const
+  PageSize* = 4096
+  MaxCachedRead* = 1 shl 20  # larger reads go straight to the debugger
+
+  # Commands that may write inferior memory (assignments, calls, stores).
+  # Variable objects evaluate arbitrary expressions, calls included.
+  InvalidatingCommands = ["-data-write-memory", "-var-assign", "-data-evaluate-expression",
+                          "-var-create", "-var-evaluate-expression", "-var-update",
+                          "-interpreter-exec", "-exec-", "-target-", "-file-", "-gdb-set"]
+
+type
+  MemoryCache* = ref object
+    commands: InternalCommands
+    emit: proc(line: string) {.closure.}     # to the IDE
+    forward: proc(line: string) {.closure.}  # to the debugger, for reads we cannot serve
+    pages: Table[int, string]                # page base -> hex contents
+    epoch: int
+    fetching: int
+    failed: bool
+    hits*, misses*, debuggerReads*: int
+
+proc newMemoryCache*(commands: InternalCommands, emit, forward: proc(line: string) {.closure.}): MemoryCache =
+  new(result)
+  result.commands = commands
+  result.emit = emit
+  result.forward = forward
+  result.pages = initTable[int, string]()
+
+proc busy*(mc: MemoryCache): bool =
+  ## True while a read is being filled; IDE input is held until it is answered
+  return mc.fetching > 0
+
+proc invalidate*(mc: MemoryCache) =
+  mc.pages.clear()
+  inc mc.epoch
+
+proc observe*(mc: MemoryCache, line: string) =
+  ## Debugger output: anything that ends the current stop drops the cache
+  if line.startsWith("*running") or line.startsWith("*stopped") or line.startsWith("=memory-changed"):
+    mc.invalidate()
+
+proc parseAddress(s: string): int =
+  ## Numeric address or -1; expressions are left to the debugger
+  try:
+    if s.startsWith("0x") or s.startsWith("0X"): return parseHexInt(s)
+    if s.len > 0 and s[0] in Digits: return parseInt(s)
+  except ValueError:
+    discard
+  return -1
+
+proc hexAddress(a: int): string =
+  return "0x" & toHex(a, 16).toLowerAscii()
+
+proc formatReply(mc: MemoryCache, token: string, start, count: int): string =
+  ## One block; like GDB, its offset is relative to the effective start
+  ## (address plus `-o`), so it is always 0
+  var contents = newStringOfCap(count * 2)
+  var a = start
+  while a < start + count:
+    let page = a div PageSize * PageSize
+    let n = min(page + PageSize, start + count) - a
+    contents.add(mc.pages[page][(a - page) * 2 ..< (a - page + n) * 2])
+    a += n
+  return token & "^done,memory=[{begin=\"" & hexAddress(start) & "\",offset=\"" & hexAddress(0) &
+         "\",end=\"" & hexAddress(start + count) & "\",contents=\"" & contents & "\"}]"
+
+proc fill(mc: MemoryCache, base, length: int, reply: string): bool =
+  ## Stores a page run read by the proxy; false unless it came back whole
+  if isErrorRecord(reply): return false
+  let contents = miFields(reply, "contents")
+  if contents.len != 1 or contents[0].len != length * 2: return false
+  if parseAddress(miField(reply, "begin")) != base: return false
+  for i in 0 ..< length div PageSize:
+    mc.pages[base + i * PageSize] = contents[0][i * PageSize * 2 ..< (i + 1) * PageSize * 2]
+  return true
+
+proc fetch(mc: MemoryCache, base, length: int, done: proc() {.closure.}) =
+  inc mc.debuggerReads
+  let epoch = mc.epoch
+  discard mc.commands.send("-data-read-memory-bytes " & hexAddress(base) & " " & $length, proc(reply: string) =
+    if epoch != mc.epoch or not mc.fill(base, length, reply):
+      mc.failed = true
+    dec mc.fetching
+    if mc.fetching == 0: done()
+  )
+
+proc noteCommand*(mc: MemoryCache, line: string): bool =
+  ## Drops the cache if the IDE command `line` may write memory; true if it did.
+  ## Also needed for commands the cache does not get to handle.
+  let command = stripToken(line)
+  for prefix in InvalidatingCommands:
+    if command.startsWith(prefix):
+      mc.invalidate()
+      return true
+  return false
+
+proc handle*(mc: MemoryCache, line: string): bool =
+  ## Takes over a numeric `-data-read-memory-bytes` (answering it now or once
+  ## its missing pages arrive) and returns true. Other commands return false
+  ## and drop the cache if they may write memory.
+  if mc.noteCommand(line): return false
+  let command = stripToken(line)
+  if not command.startsWith("-data-read-memory-bytes "): return false
+
+  # -data-read-memory-bytes [-o offset] address count
+  let args = miArgs(command)
+  var i = 1
+  var offset = 0
+  if args.len > 2 and args[1] == "-o":
+    offset = parseAddress(args[2])
+    i = 3
+  if offset < 0 or args.len != i + 2: return false
+  let address = parseAddress(args[i])
+  let count = parseAddress(args[i + 1])
+  if address < 0 or count <= 0 or count > MaxCachedRead: return false
+
+  let start = address + offset
+  var runs: seq[tuple[base, length: int]] = @[]
+  var page = start div PageSize * PageSize
+  while page < start + count:
+    if not mc.pages.hasKey(page):
+      if runs.len > 0 and runs[^1].base + runs[^1].length == page:
+        runs[^1].length += PageSize
+      else:
+        runs.add((page, PageSize))
+    page += PageSize
+
+  let token = miToken(line)
+  if runs.len == 0:
+    inc mc.hits
+    mc.emit(mc.formatReply(token, start, count))
+    mc.emit("(gdb)")
+    return true
+
+  inc mc.misses
+  mc.fetching = runs.len
+  mc.failed = false
+  let epoch = mc.epoch
+  let done = proc() =
+    if mc.failed or epoch != mc.epoch:
+      # Unmapped pages or a resume in between: let the debugger answer
+      mc.forward(line)
+    else:
+      mc.emit(mc.formatReply(token, start, count))
+      mc.emit("(gdb)")
+  for run in runs:
+    mc.fetch(run.base, run.length, done)
+  return true
+
+proc summary*(mc: MemoryCache): string =
+  return "Memory cache: " & $mc.hits & " hits, " & $mc.misses & " misses, " &
+         $mc.debuggerReads & " debugger reads"
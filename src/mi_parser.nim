@@ -0,0 +1,104 @@
+## Small helpers for picking fields out of GDB/MI records.
+##
+## These are not a full MI parser: they scan for `key="value"` pairs and
+## result-record prefixes, which is all the proxy needs on its hot path.
+
+import strutils
+
+proc unescapeMi*(s: string): string =
+  result = newStringOfCap(s.len)
+  var i = 0
+  while i < s.len:
+    if s[i] == '\\' and i + 1 < s.len:
+      case s[i+1]:
+      of '\\': result.add('\\')
+      of '"': result.add('"')
+      of 'n': result.add('\n')
+      of 't': result.add('\t')
+      else: result.add(s[i+1])
+      i += 2
+    else:
+      result.add(s[i])
+      i += 1
+
+proc escapeMi*(s: string): string =
+  result = newStringOfCap(s.len * 2)
+  for ch in s:
+    case ch:
+    of '\\': result.add("\\\\")
+    of '"': result.add("\\\"")
+    of '\n': result.add("\\n")
+    of '\t': result.add("\\t")
+    else: result.add(ch)
+
+proc miToken*(line: string): string =
+  ## Leading numeric token of a command or record ("1029-var-create" -> "1029")
+  var i = 0
+  while i < line.len and line[i] in Digits:
+    inc i
+  return line[0 ..< i]
+
+proc stripToken*(line: string): string =
+  return line[miToken(line).len .. ^1]
+
+proc isResultRecord*(line: string): bool =
+  let t = miToken(line).len
+  return t < line.len and line[t] == '^'
+
+proc isErrorRecord*(line: string): bool =
+  return stripToken(line).startsWith("^error")
+
+proc findField*(line, key: string, start: int = 0): tuple[first, last: int] =
+  ## Bounds of the raw (still escaped) value of the first `key="..."` at or
+  ## after `start`. The value is `line[first ..< last]`; (-1, -1) if absent.
+  let needle = key & "=\""
+  var pos = start
+  while true:
+    let hit = line.find(needle, pos)
+    if hit == -1:
+      return (-1, -1)
+    # Only accept whole keys, so `id` does not match inside `thread-id`
+    if hit == 0 or line[hit-1] in {',', '{', '['}:
+      let first = hit + needle.len
+      var i = first
+      while i < line.len and line[i] != '"':
+        if line[i] == '\\': inc i
+        inc i
+      return (first, min(i, line.len))
+    pos = hit + 1
+
+proc miField*(line, key: string, start: int = 0): string =
+  ## Unescaped value of the first `key="..."`, or "" if absent
+  let b = findField(line, key, start)
+  if b.first == -1: return ""
+  return unescapeMi(line[b.first ..< b.last])
+
+proc miFields*(line, key: string): seq[string] =
+  ## Unescaped values of every `key="..."` in the record, in order
+  var pos = 0
+  while true:
+    let b = findField(line, key, pos)
+    if b.first == -1: break
+    result.add(unescapeMi(line[b.first ..< b.last]))
+    pos = b.last + 1
+
+proc miArgs*(command: string): seq[string] =
+  ## Splits MI command arguments on whitespace, unquoting "c-strings"
+  var i = 0
+  while i < command.len:
+    while i < command.len and command[i] in Whitespace:
+      inc i
+    if i >= command.len: break
+    if command[i] == '"':
+      var j = i + 1
+      while j < command.len and command[j] != '"':
+        if command[j] == '\\': inc j
+        inc j
+      result.add(unescapeMi(command[i+1 ..< min(j, command.len)]))
+      i = j + 1
+    else:
+      var j = i
+      while j < command.len and command[j] notin Whitespace:
+        inc j
+      result.add(command[i ..< j])
+      i = j
@@ -1,5 +1,5 @@
 {.passL: "-lstdc++".}
-import strutils, re, symbol_map, osproc
+import strutils, re, tables, symbol_map, mi_parser, osproc
 
 # ----- Helpers -----
 proc cxa_demangle(
@@ -9,29 +9,112 @@ proc cxa_demangle(
   status: ptr cint
 ): cstring {.importc: "__cxa_demangle".}
 
+proc c_free(p: pointer) {.importc: "free", header: "<stdlib.h>".}
+
 proc demangle(mangled: string): string =
   var
     status: cint = 0
   
-  result = $cxa_demangle(
+  let buffer = cxa_demangle(
               mangled.cstring,
               nil,
               nil,
               status.addr
             )
+  if buffer == nil:
+    return ""
+  result = $buffer
+  c_free(buffer)  # __cxa_demangle mallocs the result
+
+proc demangleName*(sm: SymbolMap, mangled: string, debug: bool = false): string =
+  ## Nim demangling first, then C++ demangling for `_Z` names
+  var demangled = mangled  # Start with original
+  
+  # Only apply Nim demangling if it's NOT a C++ mangled name
+  if not mangled.startsWith("_Z"):
+    demangled = sm.demangle(mangled)
+  
+  # For C++ mangled names (or if Nim demangling didn't change it), try c++filt
+  if demangled.startsWith("_Z"):
+    if debug:
+      stderr.writeLine("Attempting C++ demangle of: " & demangled)
+    try:
+      let cxx = demangle(demangled).strip()
+      if cxx.len > 0:
+        demangled = cxx
+      if debug:
+        stderr.writeLine("  -> Demangled to: " & demangled)
+    except Exception as e:
+      if debug:
+        stderr.writeLine("  -> c++filt exception: " & e.msg)
+  
+  return demangled
+
+# ----- Debugger kinds -----
+
+type
+  DebuggerKind* = enum
+    dkGdb
+    dkLldb
+
+  InputTransformer* = proc(line: string, sm: SymbolMap, debug: bool): string {.nimcall.}
+  OutputTransformer* = proc(line: string, sm: SymbolMap, debug: bool): string {.nimcall.}
+  ExpressionTransformer* = proc(expr: string, sm: SymbolMap): string {.nimcall.}
+
+proc toDebuggerKind*(debugger: string): DebuggerKind =
+  return if debugger == "lldb": dkLldb else: dkGdb
+
+# Compiled once instead of on every line
+# Output: name="...", func="..." and type="..." with escape handling
+let outputFieldPattern = """(name|func|type)="((?:[^\"\\]|\\.)*)"""".re
+# GDB: handle C/C++/Nim patterns
+let gdbIdentPattern = re"(\[[^\]]+\]|@[a-zA-Z_][a-zA-Z0-9_]*|\b[a-zA-Z_][a-zA-Z0-9_:]*(?:->[a-zA-Z_][a-zA-Z0-9_]*)?\b)"
+# LLDB: similar patterns, but `.` is part of qualified names
+let lldbIdentPattern = re"(\[[^\]]+\]|@[a-zA-Z_][a-zA-Z0-9_]*|\b[a-zA-Z_][a-zA-Z0-9_:.]*(?:->[a-zA-Z_][a-zA-Z0-9_]*)?\b)"
 
 # ----- Output Transformer -----
 
-proc transformOutput*(line: string, sm: SymbolMap, debugger: string = "gdb", debug: bool = false): string =
-  # Transform both name="..." and func="..." fields
+proc carriesVariableTypes(line: string): bool =
+  ## Replies whose type= fields describe variables: locals, arguments,
+  ## var-objects and their children. Breakpoint and other records keep theirs.
+  let record = stripToken(line)
+  if not record.startsWith("^done"): return false
+  return record.startsWith("^done,type=") or "locals=[" in record or "variables=[" in record or
+         "args=[" in record or "children=[" in record or "numchild=" in record
+
+proc transformDisassembly*(line: string, sm: SymbolMap, debug: bool = false): string =
+  ## -data-disassemble replies carry a func-name per instruction but only a
+  ## handful of distinct functions, so each one is demangled once per reply
+  var memo = initTable[string, string]()
+  result = newStringOfCap(line.len)
+  var pos = 0
+  while true:
+    let b = findField(line, "func-name", pos)
+    if b.first == -1: break
+    result.add(line[pos ..< b.first])
+    let raw = line[b.first ..< b.last]
+    var demangled = memo.getOrDefault(raw)
+    if demangled.len == 0:
+      demangled = escapeMi(demangleName(sm, unescapeMi(raw), debug))
+      memo[raw] = demangled
+    result.add(demangled)
+    pos = b.last
+  result.add(line[pos .. ^1])
+
+proc transformOutputFor*[D: static DebuggerKind](line: string, sm: SymbolMap, debug: bool = false): string =
+  # Transform name="...", func="..." and type="..." fields
   # name="..." contains variable/parameter names
   # func="..." contains function names in stack frames
+  # type="..." contains C type names of variables and var-objects
+
+  if line.contains(",asm_insns=["):
+    return transformDisassembly(line, sm, debug)
   
   result = ""
   var pos = 0
   
-  # Pattern matches both name="..." and func="..." with escape handling
-  let pattern = """(name|func)="((?:[^\"\\]|\\.)*)"""".re
+  let pattern = outputFieldPattern
+  let typedRecord = carriesVariableTypes(line)
   var matches: array[2, string]  # [0] = field type (name/func), [1] = value
   
   while true:
@@ -43,101 +126,73 @@ proc transformOutput*(line: string, sm: SymbolMap, debugger: string = "gdb", deb
     result.add(line[pos ..< bounds.first])
     
     # Process match
-    let fieldType = matches[0]  # "name" or "func"
-    var mangled = matches[1]
-    
-    # Unescape the string
-    var unescaped = newStringOfCap(mangled.len)
-    var i = 0
-    while i < mangled.len:
-      if mangled[i] == '\\' and i + 1 < mangled.len:
-        case mangled[i+1]:
-        of '\\': unescaped.add('\\')
-        of '"': unescaped.add('"')
-        of 'n': unescaped.add('\n')
-        of 't': unescaped.add('\t')
-        else: unescaped.add(mangled[i+1])
-        i += 2
-      else:
-        unescaped.add(mangled[i])
-        i += 1
-    mangled = unescaped
-    
-    var demangled = mangled  # Start with original
-    
-    # Only apply Nim demangling if it's NOT a C++ mangled name
-    if not mangled.startsWith("_Z"):
-      demangled = sm.demangle(mangled)
-    
-    # For C++ mangled names (or if Nim demangling didn't change it), try c++filt
-    if demangled.startsWith("_Z"):
-      if debug:
-        stderr.writeLine("Attempting C++ demangle of: " & demangled)
-      try:
-        demangled = demangle(demangled).strip()
-        if debug:
-          stderr.writeLine("  -> Demangled to: " & demangled)
-      except Exception as e:
-        if debug:
-          stderr.writeLine("  -> c++filt exception: " & e.msg)
+    let fieldType = matches[0]  # "name", "func" or "type"
+    let mangled = unescapeMi(matches[1])
+
+    if fieldType == "type":
+      let typ = if typedRecord: sm.types.nimTypeName(mangled) else: mangled
+      result.add("type=\"" & escapeMi(typ) & "\"")
+      pos = bounds.last + 1
+      continue
+
+    let demangled = demangleName(sm, mangled, debug)
     
     if debug and fieldType == "func" and demangled != mangled:
       stderr.writeLine("Function transform: " & mangled & " -> " & demangled)
     
     sm.addLocal(mangled) # Auto-register potential locals seen in output
     
-    # Re-escape the demangled string
-    var escaped = newStringOfCap(demangled.len * 2)
-    for ch in demangled:
-      case ch:
-      of '\\': escaped.add("\\\\")
-      of '"': escaped.add("\\\"")
-      of '\n': escaped.add("\\n")
-      of '\t': escaped.add("\\t")
-      else: escaped.add(ch)
+    result.add(fieldType & "=\"" & escapeMi(demangled) & "\"")
     
-    result.add(fieldType & "=\"" & escaped & "\"")
+    pos = bounds.last + 1
+
+# ----- Expression Transformer -----
+
+proc transformExpressionFor*[D: static DebuggerKind](expr: string, sm: SymbolMap): string =
+  # Transform identifiers AND special demangled names (like [tmp5], [StackFrame])
+  # Pattern matches: [SpecialName] OR normalIdentifier OR Nim-specific patterns
+  # Also handle operators that might be part of names in Nim/C++ (::, ., ->)
+  let identPattern = when D == dkGdb: gdbIdentPattern else: lldbIdentPattern
+  
+  var matches: array[1, string]
+  var newExpr = ""
+  var pos = 0
+  
+  while true:
+    let bounds = findBounds(expr, identPattern, matches, start=pos)
+    if bounds.first == -1:
+      newExpr.add(expr[pos .. ^1])
+      break
+      
+    newExpr.add(expr[pos ..< bounds.first])
+    
+    let identifier = matches[0]
+    # Skip numeric literals and common operators
+    if identifier notin ["true", "false", "null", "this", "super"] and
+       not (identifier.len > 0 and identifier[0].isdigit()):
+      # Fields and members keep their spelling; only roots are looked up style-insensitively
+      var k = bounds.first - 1
+      while k >= 0 and expr[k] == ' ': dec k
+      let root = not (k >= 0 and (expr[k] == '.' or (expr[k] == '>' and k > 0 and expr[k-1] == '-')))
+      var mangled = sm.getMangled(identifier, root)
+      when D == dkLldb:
+        # Not a qualified name: a field access, whose base may be mangled
+        let dot = identifier.find('.')
+        if mangled == identifier and dot > 0:
+          mangled = sm.getMangled(identifier[0 ..< dot], root) & identifier[dot .. ^1]
+      newExpr.add(mangled)
+    else:
+      newExpr.add(identifier)
     
     pos = bounds.last + 1
+  return newExpr
 
 # ----- Input Transformer -----
 
-proc transformInput*(line: string, sm: SymbolMap, debugger: string = "gdb", debug: bool = false): string =
+proc transformInputFor*[D: static DebuggerKind](line: string, sm: SymbolMap, debug: bool = false): string =
   # Helper to transform expression parts
   proc transformExpression(expr: string): string =
-    # Transform identifiers AND special demangled names (like [tmp5], [StackFrame])
-    # Pattern matches: [SpecialName] OR normalIdentifier OR Nim-specific patterns
-    # Also handle operators that might be part of names in Nim/C++ (::, ., ->)
-    let identPattern = if debugger == "gdb":
-      # GDB: handle C/C++/Nim patterns
-      re"(\[[^\]]+\]|@[a-zA-Z_][a-zA-Z0-9_]*|\b[a-zA-Z_][a-zA-Z0-9_:]*(?:->[a-zA-Z_][a-zA-Z0-9_]*)?\b)"
-    else:
-      # LLDB: similar patterns but might differ
-      re"(\[[^\]]+\]|@[a-zA-Z_][a-zA-Z0-9_]*|\b[a-zA-Z_][a-zA-Z0-9_:.]*(?:->[a-zA-Z_][a-zA-Z0-9_]*)?\b)"
-    
-    var matches: array[1, string]
-    var newExpr = ""
-    var pos = 0
-    
-    while true:
-      let bounds = findBounds(expr, identPattern, matches, start=pos)
-      if bounds.first == -1:
-        newExpr.add(expr[pos .. ^1])
-        break
-        
-      newExpr.add(expr[pos ..< bounds.first])
-      
-      let identifier = matches[0]
-      # Skip numeric literals and common operators
-      if identifier notin ["true", "false", "null", "this", "super"] and
-         not (identifier.len > 0 and identifier[0].isdigit()):
-        let mangled = sm.getMangled(identifier)
-        newExpr.add(mangled)
-      else:
-        newExpr.add(identifier)
-      
-      pos = bounds.last + 1
-    return newExpr
+    return transformExpressionFor[D](expr, sm)
   
   # Helper to find quoted expression
   proc transformQuotedExpression(line: string): string =
@@ -357,7 +412,7 @@ proc transformInput*(line: string, sm: SymbolMap, debugger: string = "gdb", debu
     if parts.len < 2: return line
     
     let lastPart = parts[^1]
-    let mangled = sm.getMangled(lastPart)
+    let mangled = sm.getMangled(lastPart, root = true)
     
     var resultParts: seq[string] = @[]
     for i in 0..<parts.len-1:
@@ -393,21 +448,50 @@ proc transformInput*(line: string, sm: SymbolMap, debugger: string = "gdb", debu
   
   # ----- LLDB-specific commands -----
   
-  elif debugger == "lldb" and line.contains("platform-select"):
-    # LLDB-specific platform commands
-    return line
-  
-  elif debugger == "lldb" and line.contains("settings set"):
-    # LLDB settings - might contain target names
-    let parts = line.splitWhitespace()
-    if parts.len >= 4 and parts[2] == "target.executable-search-paths":
-      # This might contain paths with mangled names
-      return transformQuotedExpression(line)
-    return line
+  when D == dkLldb:
+    if line.contains("platform-select"):
+      # LLDB-specific platform commands
+      return line
+    
+    elif line.contains("settings set"):
+      # LLDB settings - might contain target names
+      let parts = line.splitWhitespace()
+      if parts.len >= 4 and parts[2] == "target.executable-search-paths":
+        # This might contain paths with mangled names
+        return transformQuotedExpression(line)
+      return line
   
   # ----- Fallthrough for other commands -----
   
   if debug:
     stderr.writeLine("Unhandled command: " & line)
   
-  return line
\ No newline at end of file
+  return line
+
+# ----- Dispatch -----
+
+proc inputTransformer*(kind: DebuggerKind): InputTransformer =
+  ## Fully specialized input transformer, picked once at startup
+  case kind
+  of dkGdb: return proc(line: string, sm: SymbolMap, debug: bool): string {.nimcall.} = transformInputFor[dkGdb](line, sm, debug)
+  of dkLldb: return proc(line: string, sm: SymbolMap, debug: bool): string {.nimcall.} = transformInputFor[dkLldb](line, sm, debug)
+
+proc outputTransformer*(kind: DebuggerKind): OutputTransformer =
+  ## Fully specialized output transformer, picked once at startup
+  case kind
+  of dkGdb: return proc(line: string, sm: SymbolMap, debug: bool): string {.nimcall.} = transformOutputFor[dkGdb](line, sm, debug)
+  of dkLldb: return proc(line: string, sm: SymbolMap, debug: bool): string {.nimcall.} = transformOutputFor[dkLldb](line, sm, debug)
+
+proc expressionTransformer*(kind: DebuggerKind): ExpressionTransformer =
+  ## Fully specialized expression transformer, picked once at startup
+  case kind
+  of dkGdb: return proc(expr: string, sm: SymbolMap): string {.nimcall.} = transformExpressionFor[dkGdb](expr, sm)
+  of dkLldb: return proc(expr: string, sm: SymbolMap): string {.nimcall.} = transformExpressionFor[dkLldb](expr, sm)
+
+proc transformInput*(line: string, sm: SymbolMap, debugger: string = "gdb", debug: bool = false): string =
+  ## Convenience wrapper; the proxy loop uses inputTransformer() instead
+  return inputTransformer(toDebuggerKind(debugger))(line, sm, debug)
+
+proc transformOutput*(line: string, sm: SymbolMap, debugger: string = "gdb", debug: bool = false): string =
+  ## Convenience wrapper; the proxy loop uses outputTransformer() instead
+  return outputTransformer(toDebuggerKind(debugger))(line, sm, debug)
\ No newline at end of file
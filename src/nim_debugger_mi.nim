@@ -1,6 +1,10 @@
-import std/[asyncdispatch, asyncfile, os, strformat, locks,os, strutils, times]
+import std/[asyncdispatch, asyncfile, os, strformat, locks,os, strutils, times, sets]
 import glob, subprocess
-import symbol_map, mi_transformer
+import symbol_map, mi_transformer, internal_commands, sampling_profiler, triage, demangle_filter,
+       function_breakpoints, completion, symbol_search, type_names, memory_cache,
+       var_objects, var_updates, selection, async_records,
+       thread_states, runtime_skip, logpoints, target_conditions, symbol_service, gdb_pool, mi_parser,
+       gdb_index, debuginfo_rewrite, breakpoint_cache
 
 const BUFFER_SIZE = 8192
 
@@ -12,6 +16,18 @@ type
     symbolsPath : string = ""
     gdbArgs     : seq[string]
     debugMode   : bool = false
+    profileHz   : int = 0  # > 0 enables the sampling profiler
+    profileOut  : string = ""
+    filterMode  : bool = false  # demangle stdin to stdout instead of proxying
+    varGcStops  : int = 0  # > 0 deletes var-objects unused for this many stops
+    asyncWindow : int = 50  # ms to collapse async notification bursts; 0 disables
+    nonStop     : bool = false  # run GDB in non-stop/mi-async mode
+    runtimeSkip : bool = true  # step over the Nim runtime
+    gdbserverPath : string = ""  # non-empty: evaluate breakpoint conditions in gdbserver
+    symbolService : string = ""  # non-empty: socket of a shared symbol service
+    gdbPool     : string = ""  # non-empty: socket of a pre-warmed GDB pool
+    gdbIndex    : bool = false  # cache an indexed copy of binaries without .gdb_index
+    bpCache     : bool = true  # insert breakpoints at addresses resolved by earlier launches
 
 proc toStdout(line: string, debugStdoutFileName: string = "") =
   if line.len == 0: return
@@ -79,6 +95,64 @@ proc parseArgs(args: seq[string]): Argument =
         result.gdbPath = arg[12 .. ^1].strip(chars = quotes)
     elif arg == "--debug":
       result.debugMode = true
+    elif arg == "--filter":
+      result.filterMode = true
+    elif arg == "--non-stop":
+      result.nonStop = true
+    elif arg == "--no-runtime-skip":
+      result.runtimeSkip = false
+    elif arg == "--gdb-index":
+      result.gdbIndex = true
+    elif arg == "--no-breakpoint-cache":
+      result.bpCache = false
+    elif arg == "--target-conditions" or arg.startswith("--target-conditions=") or arg.startswith("--target-conditions:"):
+      result.gdbserverPath = if arg == "--target-conditions": findExe("gdbserver")
+                             else: arg[20 .. ^1].strip(chars = quotes).expandTilde
+      if result.gdbserverPath.len == 0:
+        toStderr("Failed to find gdbserver for --target-conditions")
+        quit(1)
+    elif arg == "--symbol-service" or arg.startswith("--symbol-service=") or arg.startswith("--symbol-service:"):
+      try:
+        result.symbolService = if arg == "--symbol-service": defaultSocketPath()
+                               else: arg[17 .. ^1].strip(chars = quotes).expandTilde
+      except OSError as e:
+        toStderr("Not using the symbol service: " & e.msg)
+    elif arg == "--gdb-pool" or arg.startswith("--gdb-pool=") or arg.startswith("--gdb-pool:"):
+      try:
+        result.gdbPool = if arg == "--gdb-pool": defaultPoolSocket()
+                         else: arg[11 .. ^1].strip(chars = quotes).expandTilde
+      except OSError as e:
+        toStderr("Not using the GDB pool: " & e.msg)
+    elif arg == "--binary":
+      inc i
+      if i < args.len:
+        result.programPath = args[i].expandTilde
+    elif arg.startswith("--binary=") or arg.startswith("--binary:"):
+      result.programPath = arg[9 .. ^1].strip(chars = quotes).expandTilde
+    elif arg == "--profile" or arg.startswith("--profile=") or arg.startswith("--profile:"):
+      result.profileHz = 100
+      if arg != "--profile":
+        try:
+          result.profileHz = parseInt(arg[10 .. ^1].strip(chars = quotes))
+        except ValueError:
+          toStderr("Invalid profiler frequency: " & arg)
+          quit(1)
+    elif arg.startswith("--profile-out=") or arg.startswith("--profile-out:"):
+      result.profileOut = arg[14 .. ^1].strip(chars = quotes).expandTilde
+    elif arg == "--var-gc" or arg.startswith("--var-gc=") or arg.startswith("--var-gc:"):
+      result.varGcStops = 5
+      if arg != "--var-gc":
+        try:
+          result.varGcStops = parseInt(arg[9 .. ^1].strip(chars = quotes))
+        except ValueError:
+          toStderr("Invalid var-object idle stop count: " & arg)
+          quit(1)
+    elif arg.startswith("--async-window=") or arg.startswith("--async-window:"):
+      try:
+        result.asyncWindow = parseInt(arg[15 .. ^1].strip(chars = quotes))
+      except ValueError:
+        toStderr("Invalid async notification window: " & arg)
+        quit(1)
     elif arg.startsWith("--"):
       result.gdbArgs.add(arg)
     else:
@@ -108,9 +182,32 @@ proc stdinReader() {.thread.} =
     # Catch crashes
     stdinChann.send("__ERROR__: " & e.msg)
 
+proc loadSymbols(sm: SymbolMap, binaryPath, serviceSocket: string): string =
+  ## Loads from the symbol service's snapshot when one answers, else from the
+  ## binary; returns where the symbols came from
+  if serviceSocket.len > 0:
+    let snapshot = requestSnapshot(serviceSocket, binaryPath)
+    if snapshot.len > 0 and sm.loadFromSnapshot(snapshot):
+      return snapshot
+  discard sm.loadFromBinary(binaryPath)
+  return binaryPath
+
 proc main() =
   let cmd_args = commandLineParams()
+  if cmd_args.len > 0 and cmd_args[0] == "triage":
+    quit(runTriage(cmd_args[1 .. ^1]))
+  if cmd_args.len > 0 and cmd_args[0] == "symbol-service":
+    quit(runSymbolService(cmd_args[1 .. ^1]))
+  if cmd_args.len > 0 and cmd_args[0] == "rewrite-debuginfo":
+    quit(runRewriteDebuginfo(cmd_args[1 .. ^1]))
+  if cmd_args.len > 0 and cmd_args[0] == "gdb-pool":
+    quit(runGdbPool(cmd_args[1 .. ^1]))
+  if cmd_args.len > 0 and cmd_args[0] == "gdb-attach":
+    quit(runGdbAttach(cmd_args[1 .. ^1]))
+
   let arg = parseArgs(cmd_args)
+  if arg.filterMode:
+    quit(runFilter(arg.programPath, arg.symbolsPath))
 
   var
     debugStdoutFileName = ""
@@ -132,8 +229,22 @@ proc main() =
     toStderr("Loading custom symbol map from: " & arg.symbolsPath, debugStderrFileName)
     discard sm.loadFromFile(arg.symbolsPath)
   elif arg.programPath != "":
-    toStderr("Loading symbols from: " & arg.programPath, debugStderrFileName)
-    discard sm.loadFromBinary(arg.programPath)
+    toStderr("Loading symbols for: " & arg.programPath, debugStderrFileName)
+    let loadStart = getTime()
+    let source = sm.loadSymbols(arg.programPath, arg.symbolService)
+    toStderr("Symbols loaded from " & source & " in " & $(getTime() - loadStart).inMilliseconds & " ms",
+             debugStderrFileName)
+    toStderr("Mangling scheme: " & $sm.scheme, debugStderrFileName)
+    sm.types.useBinary(arg.programPath)  # DWARF types are read in the background
+
+  if arg.debugMode:
+    var reported = initHashSet[string]()
+    sm.styleCollisionHook = proc(name: string, spellings: seq[string]) =
+      if not reported.containsOrIncl(name):
+        toStderr("Style-insensitive lookup of '" & name & "' is ambiguous between: " &
+                 spellings.join(", ") & "; using '" & spellings[0] & "'", debugStderrFileName)
+  for spellings in sm.styleCollisions():
+    if arg.debugMode: toStderr("Style-insensitive name collision: " & spellings.join(", "), debugStderrFileName)
 
   # Build GDB command
   toStderr("Starting Debugger: " & arg.gdbPath & " " & arg.gdbArgs.join(" "), debugStderrFileName)
@@ -143,10 +254,39 @@ proc main() =
   var stdinChanThread: Thread[void]
   createThread(stdinChanThread, stdinReader)
 
-  # Start GDB process
+  # Symbols from the rewritten debug file (Nim names for what it renamed), else
+  # from an indexed copy when the binary has no index of its own
+  var (gdbCommand, gdbArgs) = (arg.gdbPath, arg.gdbArgs)
+  var symbolFile = ""
+  let companion = if arg.programPath.len > 0: companionPath(arg.programPath) else: ""
+  if arg.debugger == "gdb" and companion.len > 0 and fileExists(companion) and
+     fileExists(renamedListPath(companion)):
+    symbolFile = companion
+    for name in lines(renamedListPath(companion)):
+      if name.len > 0: sm.renamedInDwarf.incl(name)
+    gdbArgs = useSymbolFile(gdbArgs, arg.programPath, symbolFile)
+    toStderr("Using Nim-named debug info: " & symbolFile & " (" & $sm.renamedInDwarf.len & " names)",
+             debugStderrFileName)
+  elif arg.gdbIndex and arg.debugger == "gdb" and arg.programPath.len > 0:
+    case indexState(arg.programPath)
+    of isCached:
+      symbolFile = indexedCopyPath(arg.programPath)
+      gdbArgs = useIndexedCopy(gdbArgs, arg.programPath)
+      toStderr("Using cached symbol index: " & symbolFile, debugStderrFileName)
+    of isMissing:
+      if generateIndexInBackground(arg.programPath, arg.gdbPath):
+        toStderr("No .gdb_index in " & arg.programPath & "; building one for the next launch", debugStderrFileName)
+    of isIndexed, isNoDebugInfo:
+      discard
+
+  # Start GDB process, through the warm pool's relay when one is configured
+  if arg.gdbPool.len > 0 and arg.programPath.len > 0 and arg.debugger == "gdb":
+    (gdbCommand, gdbArgs) = (getAppFilename(),
+                             @["gdb-attach", arg.gdbPool, absolutePath(arg.programPath), arg.gdbPath] & gdbArgs)
+  var warmBinary = ""  # set when the pool handed over a GDB with this binary loaded
   let p = subprocess.startSubprocess(
-    command = arg.gdbPath,
-    args    = arg.gdbArgs,
+    command = gdbCommand,
+    args    = gdbArgs,
     options = SubprocessOptions(
       useStdin  : true,
       useStdout : true,
@@ -154,8 +294,92 @@ proc main() =
     )
   )
 
-  var inBuffer = ""
+  let commands = newInternalCommands(proc(line: string) =
+    if arg.debugMode: toStderr("PROXY -> GDB: " & line, debugStderrFileName)
+    discard p.write(line & "\n")
+  )
+
+  let threads = newThreadStates(arg.nonStop)
+  if arg.nonStop:
+    for setup in NonStopSetup:
+      discard commands.send(setup)
+    toStderr("Non-stop mode enabled", debugStderrFileName)
+
+  # Specialized transformers for this debugger, chosen once
+  let debuggerKind = toDebuggerKind(arg.debugger)
+  let transformIn = inputTransformer(debuggerKind)
+  let transformOut = outputTransformer(debuggerKind)
+
+  let bps = newFunctionBreakpoints(sm, commands, transformIn)
+  let bpCache = newBreakpointCache(
+    if arg.bpCache and arg.debugger == "gdb" and arg.programPath.len > 0: breakpointCachePath(arg.programPath)
+    else: "")
+  let completer = newCompleter(sm)
+  let search = newSymbolSearch(sm, arg.programPath)
+  search.refresh()
+
+  let runtimeSkip = arg.runtimeSkip and arg.debugger == "gdb"  # skip rules are GDB console commands
   var outBuffer = ""
+  # A held stop goes back through the output loop, so every observer sees it
+  let skipper = newRuntimeSkip(sm, commands, proc(line: string) =
+    outBuffer = line & "\n" & outBuffer
+  )
+  var conditions: TargetConditions = nil
+  if arg.gdbserverPath.len > 0:
+    conditions = newTargetConditions(commands, arg.gdbserverPath, arg.programPath,
+                                     proc(message: string) = toStderr(message, debugStderrFileName))
+    toStderr("Breakpoint conditions evaluated by: " & arg.gdbserverPath, debugStderrFileName)
+
+  let logs = newLogpoints(sm, proc(line: string) = toStdout(line, debugStdoutFileName),
+                          transform = expressionTransformer(debuggerKind))
+  if runtimeSkip:
+    toStderr("Installed " & $skipper.install() & " Nim runtime skip rules", debugStderrFileName)
+
+  let memory = newMemoryCache(commands,
+    proc(line: string) = toStdout(line, debugStdoutFileName),
+    proc(line: string) =
+      if arg.debugMode: toStderr("VS -> GDB: " & line, debugStderrFileName)
+      discard p.write(line & "\n")
+  )
+
+  let vars = newVarObjects(commands, arg.varGcStops)
+  let selected = newSelection(commands, proc(line: string) =
+    toStdout(transformOut(line, sm, arg.debugMode), debugStdoutFileName)
+  )
+  selected.nonStop = arg.nonStop
+  let updates = newVarUpdates(proc(line: string) =
+    toStdout(transformOut(line, sm, arg.debugMode), debugStdoutFileName)
+  )
+
+  let notifications = newAsyncRecords(
+    proc(line: string) = toStdout(transformOut(line, sm, arg.debugMode), debugStdoutFileName),
+    arg.asyncWindow)
+
+  var prof: Profiler = nil
+  if arg.profileHz > 0 and arg.nonStop:
+    toStderr("Sampling profiler needs all-stop mode; disabled with --non-stop", debugStderrFileName)
+  elif arg.profileHz > 0:
+    prof = newProfiler(arg.profileHz, sm, commands)
+    toStderr("Sampling profiler enabled at " & $arg.profileHz & " Hz", debugStderrFileName)
+
+  proc shutdown(code: int) =
+    if arg.debugMode:
+      toStderr(memory.summary(), debugStderrFileName)
+      toStderr(vars.summary(), debugStderrFileName)
+      toStderr(notifications.summary(), debugStderrFileName)
+      toStderr("Logpoints: " & $logs.records & " records in " & $logs.batches & " batches", debugStderrFileName)
+      toStderr("Breakpoint cache: " & $bpCache.hits & " inserts by address, " & $bpCache.learned & " learned",
+               debugStderrFileName)
+    bpCache.save()
+    if prof != nil:
+      let path = if arg.profileOut.len > 0: arg.profileOut
+                 else: fmt"""nim_profile_{now().format("yyyyMMddHHmmss")}.folded"""
+      prof.writeProfile(path)
+      toStderr(prof.summary(), debugStderrFileName)
+      toStderr("Collapsed stacks written to: " & path, debugStderrFileName)
+    quit(code)
+
+  var inBuffer = ""
   
   while true:
   
@@ -168,13 +392,35 @@ proc main() =
         if nlPos == -1: break
         let rawLine = outBuffer[0 ..< nlPos].strip()
         outBuffer = outBuffer[(nlPos + 1) .. ^1]
+        if rawLine.startsWith(WarmMarker):
+          warmBinary = miField(rawLine, "binary")
+          toStderr("Using pre-warmed GDB for " & warmBinary, debugStderrFileName)
+          continue
+        memory.observe(rawLine)
+        threads.observe(rawLine)
+        if commands.handleReply(rawLine): continue
+        let stepLine = skipper.observe(rawLine)
+        if stepLine.len == 0: continue
+        if prof != nil and prof.observe(stepLine): continue
+        vars.observe(stepLine)
+        updates.observe(stepLine)
+        selected.observe(stepLine)
+        if arg.nonStop: sm.useLocalScope(selected.selected.thread)
+        let line = bpCache.observe(bps.observe(stepLine))
+        if line.len == 0: continue
+        if logs.observe(line): continue
+        if notifications.observe(line): continue
         try:
-          let transformed = transformOutput(rawLine, sm, debug = arg.debugMode)
+          let transformed = transformOut(line, sm, arg.debugMode)
           if arg.debugMode: toStderr("Transformed Output: " & transformed, debugStderrFileName)
           toStdout(transformed, debugStdoutFileName)
         except Exception as e:
-          toStdout(rawLine, debugStdoutFileName)
+          toStdout(line, debugStdoutFileName)
     
+    notifications.tick()
+    logs.tick()
+    discard sm.types.pump()
+
     # 2. Check GDB Stderr
     while p.hasDataStderr:
       let gdbErr = p.readStderr(timeoutMs = 5)
@@ -184,8 +430,10 @@ proc main() =
     let (stdinReceived, stdinRawInput) = stdinChann.tryRecv()
     if stdinReceived: inBuffer.add(stdinRawInput & "\n")
     
-    # 4. Process stdin lines
-    while true:
+    # 4. Process stdin lines (held back while the profiler has the inferior
+    #    stopped or a memory read is being filled)
+    if prof != nil: prof.tick()
+    while (prof == nil or not prof.busy) and not memory.busy:
       let nlPos = inBuffer.find('\n')
       if nlPos == -1: break
       var rawLine = inBuffer[0 ..< nlPos].strip()
@@ -196,29 +444,84 @@ proc main() =
       # [CHECK 1] Check for Reader Thread Crash/EOF
       if rawLine == "__EOF__":
         toStderr("Stdin closed by VS Code.", debugStderrFileName)
-        quit(0)
+        shutdown(0)
       
       if rawLine.startsWith("__ERROR__"):
         toStderr("Reader Thread Crashed: " & rawLine, debugStderrFileName)
-        quit(1)
+        shutdown(1)
 
       # [CHECK 2] Handle Symbols loading
       if rawLine.contains("-file-exec-and-symbols"):
         let parts = rawLine.split(maxsplit=1)
         if parts.len == 2:
           let path = parts[1].strip
-          if fileExists(path):
+          if warmBinary.len > 0 and absolutePath(path.strip(chars = {'"'})) == warmBinary:
+            # Already loaded by the pool, and our symbols came from the same file
+            toStdout(miToken(rawLine) & "^done", debugStdoutFileName)
+            toStdout("(gdb)", debugStdoutFileName)
+            continue
+          if symbolFile.len > 0 and absolutePath(path.strip(chars = {'"'})) == absolutePath(arg.programPath):
+            # Execute the program, but read its symbols from the indexed or rewritten copy
+            discard commands.send("-file-symbol-file \"" & escapeMi(symbolFile) & "\"")
+            rawLine = miToken(rawLine) & "-file-exec-file " & path
+          elif fileExists(path):
             if arg.debugMode: toStderr("Dynamically loading symbols from: " & path, debugStderrFileName)
-            discard sm.loadFromBinary(path)
+            discard sm.loadSymbols(path, arg.symbolService)
+            sm.types = newTypeNames()
+            sm.types.useBinary(path)
+            search.useBinary(path)
+            search.refresh()
+            if runtimeSkip: discard skipper.install()
+
+      # [CHECK 3] Answer console completion locally with Nim names
+      let completionReply = completer.complete(rawLine)
+      if completionReply.len > 0:
+        if arg.debugMode: toStderr("Completed locally: " & rawLine, debugStderrFileName)
+        toStdout(completionReply, debugStdoutFileName)
+        toStdout("(gdb)", debugStdoutFileName)
+        continue
+
+      # [CHECK 4] Answer symbol searches from the trigram index
+      let searchReply = search.answer(rawLine)
+      if searchReply.len > 0:
+        if arg.debugMode: toStderr("Searched locally: " & rawLine, debugStderrFileName)
+        for record in searchReply:
+          toStdout(record, debugStdoutFileName)
+        toStdout("(gdb)", debugStdoutFileName)
+        continue
+
+      # [CHECK 5] Serve memory reads from the page cache (only while no thread runs)
+      if threads.anyRunning:
+        discard memory.noteCommand(rawLine)
+      elif memory.handle(rawLine):
+        if arg.debugMode: toStderr("Memory read via cache: " & rawLine, debugStderrFileName)
+        continue
+
+      # [CHECK 6] Answer repeated -var-update from the first identical one
+      if updates.handle(rawLine):
+        if arg.debugMode: toStderr("Coalesced: " & rawLine, debugStderrFileName)
+        continue
+
+      # [CHECK 7] Track thread/frame selection; scope queries with --thread/--frame
+      rawLine = selected.rewrite(rawLine)
+      if rawLine.len == 0:
+        continue
+      if arg.nonStop: sm.useLocalScope(selected.selected.thread)
+      rawLine = threads.rewrite(rawLine)
+      rawLine = logs.rewrite(rawLine)
+      if conditions != nil: rawLine = conditions.rewrite(rawLine)
 
-      # [CHECK 3] TRANSFORM INPUT
+      # [CHECK 8] TRANSFORM INPUT
       # Sanitize "CON" arguments to prevent GDB/MIEngine confusion
       if rawLine.contains("-exec-arguments"):
          rawLine = rawLine.replace("2>CON", "").replace("1>CON", "").replace("<CON", "").strip()
       
       try:
         if arg.debugMode: toStderr("VS -> GDB: " & rawLine, debugStderrFileName)
-        let transformed = transformInput(rawLine, sm)
+        vars.noteInput(rawLine)
+        if runtimeSkip: skipper.noteInput(rawLine)
+        let transformed = bpCache.rewrite(rawLine, transformIn(bps.expandInsert(rawLine), sm, arg.debugMode))
+        bps.mirror(transformed)
         discard p.write(transformed & "\n")
       except Exception as e:
         toStderr("Error forwarding input: " & e.msg, debugStderrFileName)
@@ -227,7 +530,7 @@ proc main() =
     # 5. Check if process is still running
     if not p.isRunning:
       toStderr("GDB Exited", debugStderrFileName)
-      quit(0)
+      shutdown(0)
     
     # 6. Small sleep
     sleep(5)
@@ -0,0 +1,114 @@
+## Keeps stepping out of the Nim runtime.
+##
+## `step` into Nim code keeps landing in runtime internals (`nimDecRefIsLast`,
+## `=destroy` hooks, `rawAlloc`, ...). At startup the proxy installs GDB
+## `skip` rules for the runtime's files and functions, with the runtime
+## modules taken from the SymbolMap. If a step still stops inside the
+## runtime, the proxy finishes out of it on its own. `finish` returns to the
+## middle of the caller's line, so the proxy then repeats the IDE's step to reach
+## a line boundary. The IDE sees a single `end-stepping-range` stop in user code.
+
+import std/[sets, strutils, re]
+import symbol_map, mi_parser, internal_commands
+
+const
+  MaxHops = 8  # finishes per IDE step before giving up and showing the stop
+  RuntimeModules = ["system", "alloc", "excpt", "gc", "orc", "arc", "sysstr", "seqs_v2",
+                    "strs_v2", "assertions", "fatal", "osalloc", "dyncalls", "repr_v2"]
+  # Runtime entry points exported without a module suffix, and lifetime hooks
+  RuntimePattern = "^(nim[A-Z][a-zA-Z0-9]*|eq(destroy|copy|sink|dup|wasMoved|trace)_[a-zA-Z0-9_]*|" &
+                   "raw(Alloc|Dealloc|NewString|NewStringNoInit)|alloc0?Impl|dealloc(Impl)?|newObj(RC1)?|" &
+                   "newSeq(RC1)?|incRef|decRef|popFrame|pushFrame|copyString(RC1)?|raiseExceptionEx|" &
+                   "prepareAdd|setLengthStr|resizeString|addChar|mnewString)$"
+
+type
+  RuntimeSkip* = ref object
+    sm: SymbolMap
+    commands: InternalCommands
+    emit: proc(line: string) {.closure.}  # back into the output loop, ahead of the unread output
+    installed: HashSet[string]
+    rx: Regex
+    stepping: bool
+    step: string  # the IDE's step command, repeated after a finish
+    hops: int
+    swallowRunning: bool
+    finishes*: int
+
+proc newRuntimeSkip*(sm: SymbolMap, commands: InternalCommands,
+                     emit: proc(line: string) {.closure.}): RuntimeSkip =
+  new(result)
+  result.sm = sm
+  result.commands = commands
+  result.emit = emit
+  result.installed = initHashSet[string]()
+  result.rx = re(RuntimePattern)
+
+proc isRuntime*(rs: RuntimeSkip, mangled: string): bool =
+  return mangled.len > 0 and (nimModuleOf(mangled) in RuntimeModules or mangled.match(rs.rx))
+
+proc skipRules*(rs: RuntimeSkip): seq[string] =
+  ## GDB `skip` commands for the runtime of the loaded binary
+  result = @["skip -gfile */lib/system/*", "skip -gfile */lib/system.nim",
+             "skip -rfunction " & RuntimePattern]
+  var modules: seq[string] = @[]
+  for name in rs.sm.procsByName.keys:
+    let dot = name.find('.')
+    if dot > 0 and name[0 ..< dot] in RuntimeModules and name[0 ..< dot] notin modules:
+      modules.add(name[0 ..< dot])
+  if modules.len > 0:
+    # Nim 2 module-qualified names: rawAlloc__system_u4711
+    result.add("skip -rfunction __(" & modules.join("|") & ")_u[0-9]+$")
+
+proc install*(rs: RuntimeSkip): int =
+  ## Sends the rules not installed yet; returns how many were sent
+  for rule in rs.skipRules():
+    if rule notin rs.installed:
+      rs.installed.incl(rule)
+      discard rs.commands.send("-interpreter-exec console \"" & escapeMi(rule) & "\"")
+      inc result
+
+proc noteInput*(rs: RuntimeSkip, line: string) =
+  let command = stripToken(line)
+  if command.startsWith("-exec-"):
+    rs.stepping = (command.startsWith("-exec-step") or command.startsWith("-exec-next")) and
+                  not command.contains("-instruction")
+    rs.step = command
+    rs.hops = 0
+
+proc resume(rs: RuntimeSkip, command, stop: string) =
+  discard rs.commands.send(command,
+    proc(reply: string) =
+      if isErrorRecord(reply):
+        # e.g. the outermost frame: show the stop after all
+        rs.swallowRunning = false
+        rs.stepping = false
+        rs.emit(stop)
+  )
+
+proc observe*(rs: RuntimeSkip, line: string): string =
+  ## Debugger output to forward: "" for the stops and resumes of the proxy's
+  ## own finishes, and the final stop presented as the end of the step
+  if line.startsWith("*running") and rs.swallowRunning:
+    rs.swallowRunning = false
+    return ""
+  if not rs.stepping or not line.startsWith("*stopped"): return line
+
+  let reason = miField(line, "reason")
+  if reason in ["end-stepping-range", "function-finished"] and rs.hops < MaxHops and
+     rs.isRuntime(miField(line, "func")):
+    inc rs.hops
+    inc rs.finishes
+    rs.swallowRunning = true
+    let thread = miField(line, "thread-id")
+    rs.resume("-exec-finish" & (if thread.len > 0: " --thread " & thread else: ""), line)
+    return ""
+
+  if rs.hops > 0 and rs.hops < MaxHops and reason == "function-finished":
+    # Back in user code, but mid-line: finish the line with the IDE's own step
+    inc rs.hops
+    rs.swallowRunning = true
+    rs.resume(rs.step, line)
+    return ""
+
+  rs.stepping = false
+  return line
@@ -0,0 +1,155 @@
+## Sampling profiler built on the MI proxy ("poor man's profiler").
+##
+## While the inferior runs, the profiler periodically interrupts it, lists the
+## frames of every thread, resumes it and aggregates the demangled stacks into
+## collapsed-stack output (`outer;inner count` per line) that flamegraph tools
+## consume directly. The interrupt/resume records it causes never reach the IDE.
+
+import std/[tables, times, monotimes, strutils, strformat, algorithm]
+import symbol_map, mi_transformer, mi_parser, internal_commands
+
+type
+  Profiler* = ref object
+    interval*: Duration
+    sm: SymbolMap
+    commands: InternalCommands
+    running: bool         # inferior is running as far as the IDE knows
+    sampling: bool        # interrupt sent, inferior not resumed yet
+    awaitingStop: bool    # waiting for the *stopped caused by our interrupt
+    swallowRunning: bool  # next *running comes from our -exec-continue
+    pendingThreads: int
+    nextSample: MonoTime
+    sampleStart: MonoTime
+    firstRun: MonoTime
+    # Interned frames and stacks: each distinct name is stored once, each
+    # distinct stack once as a sequence of frame ids (outermost first)
+    frameIds: Table[string, int]
+    frameNames*: seq[string]
+    stacks: Table[seq[int], int]
+    samples*: int
+    sampleTime*: Duration  # total time the inferior was held stopped by us
+
+proc newProfiler*(hz: int, sm: SymbolMap, commands: InternalCommands): Profiler =
+  new(result)
+  result.interval = initDuration(microseconds = 1_000_000 div max(hz, 1))
+  result.sm = sm
+  result.commands = commands
+  result.frameIds = initTable[string, int]()
+  result.stacks = initTable[seq[int], int]()
+
+proc busy*(p: Profiler): bool =
+  ## True while a sample is in flight; IDE commands should wait until it ends
+  return p.sampling
+
+proc internFrame(p: Profiler, name: string): int =
+  result = p.frameIds.getOrDefault(name, -1)
+  if result == -1:
+    result = p.frameNames.len
+    p.frameNames.add(name)
+    p.frameIds[name] = result
+
+proc addSample*(p: Profiler, frames: seq[string]) =
+  ## Records one stack; `frames` is innermost first, as GDB lists them
+  if frames.len == 0: return
+  var stack = newSeqOfCap[int](frames.len)
+  for i in countdown(frames.len - 1, 0):
+    stack.add(p.internFrame(frames[i]))
+  p.stacks.mgetOrPut(stack, 0) += 1
+
+proc collapsed*(p: Profiler): string =
+  ## Collapsed-stack text, one `frame;frame;... count` line per distinct stack
+  var lines: seq[string] = @[]
+  for stack, count in p.stacks:
+    var names = newSeqOfCap[string](stack.len)
+    for id in stack:
+      names.add(p.frameNames[id])
+    lines.add(names.join(";") & " " & $count)
+  lines.sort()
+  for line in lines:
+    result.add(line & "\n")
+
+proc summary*(p: Profiler): string =
+  let wall = if p.firstRun == default(MonoTime): initDuration() else: getMonoTime() - p.firstRun
+  let stoppedMs = p.sampleTime.inMicroseconds.float / 1000.0
+  let perSample = if p.samples > 0: stoppedMs / p.samples.float else: 0.0
+  let overhead = if wall.inMicroseconds > 0: 100.0 * p.sampleTime.inMicroseconds.float / wall.inMicroseconds.float else: 0.0
+  return &"Profiler: {p.samples} samples, {p.stacks.len} distinct stacks, {p.frameNames.len} frames, " &
+         &"{perSample:.3f} ms/sample, {overhead:.2f}% of run time spent sampling"
+
+proc writeProfile*(p: Profiler, path: string) =
+  writeFile(path, p.collapsed())
+
+# ----- Sampling state machine -----
+
+proc resume(p: Profiler) =
+  p.swallowRunning = true
+  discard p.commands.send("-exec-continue", proc(reply: string) =
+    if isErrorRecord(reply):
+      p.swallowRunning = false
+      p.running = false
+  )
+  p.sampleTime += getMonoTime() - p.sampleStart
+  inc p.samples
+  p.sampling = false
+  p.nextSample = getMonoTime() + p.interval
+
+proc collectStacks(p: Profiler) =
+  discard p.commands.send("-thread-info", proc(reply: string) =
+    let ids = if isErrorRecord(reply): newSeq[string]() else: miFields(reply, "id")
+    if ids.len == 0:
+      p.resume()
+      return
+    p.pendingThreads = ids.len
+    for id in ids:
+      discard p.commands.send("-stack-list-frames --thread " & id, proc(frames: string) =
+        if not isErrorRecord(frames):
+          var names: seq[string] = @[]
+          for f in miFields(frames, "func"):
+            names.add(demangleName(p.sm, f))
+          p.addSample(names)
+        dec p.pendingThreads
+        if p.pendingThreads == 0:
+          p.resume()
+      )
+  )
+
+proc observe*(p: Profiler, line: string): bool =
+  ## Watches debugger output for run-state changes. Returns true for records
+  ## caused by the profiler itself, which must not be forwarded to the IDE.
+  if line.startsWith("*running"):
+    if p.swallowRunning:
+      p.swallowRunning = false
+      return true
+    if not p.running:
+      p.running = true
+      p.nextSample = getMonoTime() + p.interval
+      if p.firstRun == default(MonoTime):
+        p.firstRun = getMonoTime()
+  elif line.startsWith("*stopped"):
+    if p.awaitingStop:
+      p.awaitingStop = false
+      let reason = miField(line, "reason")
+      let signal = miField(line, "signal-name")
+      if reason == "" or (reason == "signal-received" and signal in ["SIGINT", "0"]):
+        p.collectStacks()
+        return true
+      # Something else (a breakpoint, an exit) stopped the inferior first
+      p.sampling = false
+    p.running = false
+  return false
+
+proc tick*(p: Profiler) =
+  ## Called from the proxy loop; interrupts the inferior when a sample is due
+  if not p.running or p.sampling: return
+  let now = getMonoTime()
+  if now < p.nextSample: return
+
+  p.sampling = true
+  p.awaitingStop = true
+  p.sampleStart = now
+  discard p.commands.send("-exec-interrupt", proc(reply: string) =
+    if isErrorRecord(reply):
+      p.sampling = false
+      p.awaitingStop = false
+      p.nextSample = getMonoTime() + p.interval
+  )
@@ -0,0 +1,179 @@
+## Thread and frame selection tracked by the proxy.
+##
+## IDEs send `-thread-select N` and `-stack-select-frame M` before each query.
+## The proxy answers frame selects itself when the frame is known to exist
+## (from this stop's `-stack-info-depth` and `-stack-list-frames` replies), and
+## repeated thread selects from the reply GDB gave earlier in the same stop.
+## Other frame selects go to GDB, which checks them. Queries that depend on the
+## frame get explicit `--thread N --frame M` options instead. Other commands
+## that rely on GDB's own selection get an internal `-stack-select-frame`
+## first, so they keep their meaning.
+
+import std/[tables, strutils]
+import mi_parser, internal_commands
+
+const
+  # Commands that accept --thread/--frame and only need them to pick a frame
+  FrameScopedCommands = ["-stack-list-locals", "-stack-list-arguments", "-stack-list-variables",
+                         "-stack-info-frame", "-stack-info-depth", "-stack-list-frames",
+                         "-var-create", "-data-evaluate-expression", "-data-list-register-values",
+                         "-exec-finish", "-exec-return"]
+  # Commands that neither read nor change the selected frame
+  SelectionFreeCommands = ["-var-update", "-var-list-children", "-var-evaluate-expression",
+                           "-var-info-", "-var-show-", "-var-set-format", "-var-delete",
+                           "-break-", "-data-read-memory", "-data-write-memory",
+                           "-thread-info", "-list-", "-gdb-", "-file-", "-environment-",
+                           "-complete", "-symbol-info-", "-enable-", "-info-"]
+
+type
+  Selection* = ref object
+    commands: InternalCommands
+    emit: proc(line: string) {.closure.}  # to the IDE
+    thread: string                        # selected thread, same for IDE and GDB ("" = unknown)
+    ideFrame: string                      # frame the IDE selected
+    gdbFrame: string                      # frame GDB has selected
+    selectReplies: Table[string, string]  # thread -> -thread-select reply, this stop
+    pendingSelects: Table[string, string] # token -> thread of a forwarded -thread-select
+    pendingFrames: Table[string, tuple[ide, gdb: string]]  # token -> frames to restore if a forwarded select fails
+    pendingDepths: Table[string, string]  # token -> thread of a forwarded stack depth or listing
+    depths: Table[string, int]            # thread -> frames known to exist, this stop
+    nonStop*: bool                        # stops of other threads keep the selection
+    dropped*: int
+
+proc newSelection*(commands: InternalCommands, emit: proc(line: string) {.closure.}): Selection =
+  new(result)
+  result.commands = commands
+  result.emit = emit
+  result.selectReplies = initTable[string, string]()
+  result.pendingSelects = initTable[string, string]()
+  result.pendingFrames = initTable[string, tuple[ide, gdb: string]]()
+  result.pendingDepths = initTable[string, string]()
+  result.depths = initTable[string, int]()
+
+proc selected*(s: Selection): tuple[thread, frame: string] =
+  return (s.thread, s.ideFrame)
+
+proc select(s: Selection, thread, frame: string) =
+  s.thread = thread
+  s.ideFrame = frame
+  s.gdbFrame = frame
+
+proc hasPrefix(command: string, prefixes: openArray[string]): bool =
+  for prefix in prefixes:
+    if command.startsWith(prefix): return true
+  return false
+
+proc withoutFrame(reply: string): string =
+  ## `reply` without its frame={...} tuple
+  let start = reply.find(",frame={")
+  if start < 0: return reply
+  var depth = 0
+  var inString = false
+  var i = start + ",frame=".len
+  while i < reply.len:
+    let c = reply[i]
+    if inString:
+      if c == '\\': inc i
+      elif c == '"': inString = false
+    elif c == '"':
+      inString = true
+    elif c == '{':
+      inc depth
+    elif c == '}':
+      dec depth
+      if depth == 0: return reply[0 ..< start] & reply[i + 1 .. ^1]
+    inc i
+  return reply
+
+proc reply(s: Selection, line: string) =
+  s.emit(line)
+  s.emit("(gdb)")
+  inc s.dropped
+
+proc rewrite*(s: Selection, line: string): string =
+  ## The command to forward, or "" if the selection change was answered here
+  let token = miToken(line)
+  let command = stripToken(line)
+  let args = command.splitWhitespace()
+  if args.len == 0: return line
+
+  case args[0]
+  of "-thread-select":
+    if args.len != 2: return line
+    if args[1] == s.thread and s.selectReplies.hasKey(args[1]):
+      # Reselecting the current thread keeps the selected frame too; the
+      # cached frame is only right if that is still the one GDB reported
+      let cached = s.selectReplies[args[1]]
+      s.reply(token & (if miField(cached, "level") == s.ideFrame: cached else: withoutFrame(cached)))
+      return ""
+    if token.len > 0: s.pendingSelects[token] = args[1]
+    s.select(args[1], "0")
+    return line
+  of "-stack-select-frame":
+    if args.len != 2 or s.thread.len == 0: return line
+    let level = try: parseInt(args[1]) except ValueError: -1
+    if level >= 0 and level < s.depths.getOrDefault(s.thread, 1):
+      s.ideFrame = args[1]
+      s.reply(token & "^done")
+      return ""
+    # Not known to exist: GDB checks it
+    if token.len > 0: s.pendingFrames[token] = (s.ideFrame, s.gdbFrame)
+    s.ideFrame = args[1]
+    s.gdbFrame = args[1]
+    return line
+  else:
+    discard
+
+  if s.thread.len == 0 or "--thread" in args or "--frame" in args:
+    return line
+  if command.hasPrefix(FrameScopedCommands):
+    if token.len > 0 and args[0] in ["-stack-info-depth", "-stack-list-frames"]:
+      s.pendingDepths[token] = s.thread
+    return token & args[0] & " --thread " & s.thread & " --frame " & s.ideFrame &
+           command[args[0].len .. ^1]
+  if s.ideFrame != s.gdbFrame and not command.hasPrefix(SelectionFreeCommands):
+    discard s.commands.send("-stack-select-frame " & s.ideFrame)
+    s.gdbFrame = s.ideFrame
+  return line
+
+proc observe*(s: Selection, line: string) =
+  ## Debugger output: stops and CLI selection changes move the selection
+  if line.startsWith("*running"):
+    s.selectReplies.clear()
+    s.depths.clear()
+  elif line.startsWith("*stopped"):
+    s.selectReplies.clear()
+    s.depths.clear()
+    let thread = miField(line, "thread-id")
+    if thread.len > 0 and (not s.nonStop or s.thread.len == 0 or s.thread == thread):
+      s.select(thread, "0")
+  elif line.startsWith("=thread-selected"):
+    let level = miField(line, "level")
+    s.select(miField(line, "id"), if level.len > 0: level else: "0")
+  elif s.pendingSelects.len + s.pendingFrames.len + s.pendingDepths.len > 0 and isResultRecord(line):
+    let token = miToken(line)
+    if s.pendingSelects.hasKey(token):
+      let thread = s.pendingSelects[token]
+      s.pendingSelects.del(token)
+      if isErrorRecord(line):
+        s.thread = ""  # GDB kept its old selection, which we no longer know
+      else:
+        s.selectReplies[thread] = stripToken(line)
+    elif s.pendingFrames.hasKey(token):
+      if isErrorRecord(line):
+        (s.ideFrame, s.gdbFrame) = s.pendingFrames[token]
+      s.pendingFrames.del(token)
+    elif s.pendingDepths.hasKey(token):
+      let thread = s.pendingDepths[token]
+      s.pendingDepths.del(token)
+      if isErrorRecord(line): return
+      var depth = 0
+      try:
+        let reported = miField(line, "depth")
+        if reported.len > 0: depth = parseInt(reported)
+        for level in miFields(line, "level"):
+          depth = max(depth, parseInt(level) + 1)
+      except ValueError:
+        discard
+      if depth > s.depths.getOrDefault(thread, 1):
+        s.depths[thread] = depth
@@ -1,23 +1,85 @@
-import strutils, tables, re, osproc, os, json
+import strutils, tables, sets, re, osproc, os, json, memfiles
+import type_names
 
 type
+  ManglingScheme* = enum
+    msGeneric  ## Unknown compiler: every rule below, in the historical order
+    msNim1     ## Nim 1.x: `name__<hash>` globals, parameters keep their names
+    msNim2     ## Nim 2.0/2.2: `name__module_u<N>` globals, `name_p<N>` parameters
+
+  ManglingRule = enum
+    mrParamSuffix   # abc_p0
+    mrUniqueSuffix  # name__module_u12 (must end in _u<N>)
+    mrHashSuffix    # name__<anything>
+
+  Demangler* = proc(mangled: string): string {.nimcall.}
+
+  LocalScope = object
+    demangledToMangled: Table[string, string]
+    normalized: Table[string, string]
+
   SymbolMap* = ref object
     globalMangledToDemangled*: Table[string, string]
     globalDemangledToMangled*: Table[string, seq[string]]
     localDemangledToMangled*: Table[string, string]
+    # "proc" and "module.proc" -> every mangled overload/instantiation
+    procsByName*: Table[string, seq[string]]
+    addresses*: Table[string, string]  # mangled -> address, when loaded from a binary
+    # Symbols that are not Nim-mangled (main, NimMain, libc, C code) -> is a function
+    plainSymbols*: Table[string, bool]
+    # Bumped whenever globals are added, so indexes built from them can tell they are stale
+    generation*: int
+    kindsKnown*: bool  # false for JSON maps, which do not say what is a function
+    # Globals whose DWARF already carries the demangled name (rewrite-debuginfo);
+    # GDB is asked for them by that name
+    renamedInDwarf*: HashSet[string]
+    # Nim identifiers are style-insensitive: normalized key -> demangled spellings
+    globalNormalized*: Table[string, seq[string]]
+    localNormalized*: Table[string, string]
+    # Called when a style-insensitive lookup matches several distinct spellings
+    styleCollisionHook*: proc(name: string, spellings: seq[string]) {.closure.}
+    scheme*: ManglingScheme
+    demangler: Demangler  # demangleAs[scheme], chosen once per binary
+    types*: TypeNames  # C type name -> Nim spelling for type="..." fields
+    # Inactive local scopes (one per thread in non-stop mode)
+    localScopes: Table[string, LocalScope]
+    localScope*: string
+
+const schemeRules: array[ManglingScheme, set[ManglingRule]] = [
+  msGeneric: {mrParamSuffix, mrHashSuffix},
+  msNim1: {mrHashSuffix},
+  msNim2: {mrParamSuffix, mrUniqueSuffix}
+]
+
+proc setScheme*(self: SymbolMap, scheme: ManglingScheme)
 
 proc newSymbolMap*(): SymbolMap =
   new(result)
   result.globalMangledToDemangled = initTable[string, string]()
   result.globalDemangledToMangled = initTable[string, seq[string]]()
   result.localDemangledToMangled = initTable[string, string]()
+  result.procsByName = initTable[string, seq[string]]()
+  result.addresses = initTable[string, string]()
+  result.plainSymbols = initTable[string, bool]()
+  result.renamedInDwarf = initHashSet[string]()
+  result.kindsKnown = true
+  result.globalNormalized = initTable[string, seq[string]]()
+  result.localNormalized = initTable[string, string]()
+  result.localScopes = initTable[string, LocalScope]()
+  result.types = newTypeNames()
+  result.setScheme(msGeneric)
 
 # Updated regex patterns to include _p0, _p1, _p2, etc.
 let reGlobal = re"^([a-zA-Z_][a-zA-Z0-9_]*)__[a-zA-Z0-9_]+$"
 let reLocal = re"^([a-zA-Z_][a-zA-Z0-9_]*)_[0-9a-fA-F]+$"
 let reParam = re"^([a-zA-Z_][a-zA-Z0-9_]*)_p[0-9]+$"  # NEW: for function parameters
+let reUnique = re"^([a-zA-Z_][a-zA-Z0-9_]*)__[a-zA-Z0-9_]*_u[0-9]+$"
+
+proc demangleAs*[S: static ManglingScheme](mangled: string): string =
+  ## Demangler specialized for one compiler's scheme: rules the scheme does
+  ## not use are compiled out instead of being tested at runtime
+  const rules = schemeRules[S]
 
-proc demangle*(self: SymbolMap, mangled: string): string =
   # Special cases first
   if mangled == "FR_":
     return "[StackFrame]"
@@ -43,8 +105,9 @@ proc demangle*(self: SymbolMap, mangled: string): string =
   
   # Handle function parameters: abc_p0, def_p1, etc. - NEW
   var matches: array[1, string]
-  if match(mangled, reParam, matches):
-    return matches[0]
+  when mrParamSuffix in rules:
+    if match(mangled, reParam, matches):
+      return matches[0]
   
   # Handle i_1, res_1, data_1 patterns
   if mangled.endsWith("_1"):
@@ -57,8 +120,12 @@ proc demangle*(self: SymbolMap, mangled: string): string =
     return "[ThreadLocal]"
   
   # Standard Nim symbol demangling
-  if match(mangled, reGlobal, matches):
-    return matches[0]
+  when mrUniqueSuffix in rules:
+    if match(mangled, reUnique, matches):
+      return matches[0]
+  when mrHashSuffix in rules:
+    if match(mangled, reGlobal, matches):
+      return matches[0]
   if match(mangled, reLocal, matches):
     return matches[0]
   
@@ -66,8 +133,9 @@ proc demangle*(self: SymbolMap, mangled: string): string =
   let parts = mangled.split('_')
   if parts.len == 2 and parts[1].len > 0:
     # Check if it's a parameter pattern (p followed by number)
-    if parts[1].len >= 2 and parts[1][0] == 'p' and parts[1][1..^1].allCharsInSet({'0'..'9'}):
-      return parts[0]
+    when mrParamSuffix in rules:
+      if parts[1].len >= 2 and parts[1][0] == 'p' and parts[1][1..^1].allCharsInSet({'0'..'9'}):
+        return parts[0]
     
     # Check if it's just decimal numbers
     var allDigits = true
@@ -80,6 +148,44 @@ proc demangle*(self: SymbolMap, mangled: string): string =
   
   return mangled
 
+proc setScheme*(self: SymbolMap, scheme: ManglingScheme) =
+  self.scheme = scheme
+  case scheme
+  of msGeneric: self.demangler = proc(mangled: string): string {.nimcall.} = demangleAs[msGeneric](mangled)
+  of msNim1: self.demangler = proc(mangled: string): string {.nimcall.} = demangleAs[msNim1](mangled)
+  of msNim2: self.demangler = proc(mangled: string): string {.nimcall.} = demangleAs[msNim2](mangled)
+
+proc demangle*(self: SymbolMap, mangled: string): string =
+  return self.demangler(mangled)
+
+proc detectScheme*(names: openArray[string]): ManglingScheme =
+  ## Guesses the compiler's mangling scheme from a binary's symbol names.
+  ## Native Nim binaries carry no NimVersion data and the .comment section
+  ## only names the C compiler, so the shape of module-qualified names is
+  ## the most reliable signal.
+  var qualified = 0
+  for name in names:
+    if name.find("__") <= 0: continue
+    if name.match(reUnique):
+      return msNim2
+    inc qualified
+  if qualified > 0:
+    return msNim1
+  return msGeneric
+
+proc normalizeIdent*(name: string): string =
+  ## Nim's identifier equality: first character exact, the rest lowercased
+  ## with underscores removed (`myVar`, `my_var` and `myvar` are one name)
+  return nimIdentNormalize(name)
+
+proc indexGlobalStyle(self: SymbolMap, demangled: string) =
+  if demangled.len == 0 or demangled[0] == '[': return
+  let key = normalizeIdent(demangled)
+  if not self.globalNormalized.hasKey(key):
+    self.globalNormalized[key] = @[demangled]
+  elif demangled notin self.globalNormalized[key]:
+    self.globalNormalized[key].add(demangled)
+
 proc addGlobal*(self: SymbolMap, mangled: string) =
   let demangled = self.demangle(mangled)
   if demangled == mangled: 
@@ -88,17 +194,87 @@ proc addGlobal*(self: SymbolMap, mangled: string) =
   self.globalMangledToDemangled[mangled] = demangled
   if not self.globalDemangledToMangled.hasKey(demangled):
     self.globalDemangledToMangled[demangled] = @[]
+    self.indexGlobalStyle(demangled)
   self.globalDemangledToMangled[demangled].add(mangled)
+  inc self.generation
+
+proc styleCollisions*(self: SymbolMap): seq[seq[string]] =
+  ## Groups of distinct global spellings that Nim considers the same name
+  for spellings in self.globalNormalized.values:
+    if spellings.len > 1:
+      result.add(spellings)
+
+const
+  # Nim 2 qualifies standard library modules with their directory, `Z` for
+  # the separator: `split__pureZstrutils_u12`, `toHex__stdZprivateZdigitsutils_u5`
+  LibDirs = ["pure", "std", "core", "impure", "posix", "windows", "wrappers", "deprecated",
+             "system", "collections", "concurrency", "private", "experimental"]
+
+proc nimModuleOf*(mangled: string): string =
+  ## Module part of a Nim 2 module-qualified symbol ("process__modA_u12" ->
+  ## "modA", "split__pureZstrutils_u3" -> "strutils"), or "" when the name
+  ## carries none. Nim 1.x `name__<hash>` names have no module; their procs
+  ## are found by name only.
+  let sep = mangled.find("__")
+  if sep <= 0: return ""
+  result = mangled[sep+2 .. ^1]
+  # Nim 2 ends the module with a _u<N> uniqueness suffix
+  let us = result.rfind("_u")
+  if us <= 0 or us + 2 >= result.len or not result[us+2 .. ^1].allCharsInSet({'0'..'9'}):
+    return ""
+  result = result[0 ..< us]
+  while true:
+    let z = result.find('Z')
+    if z <= 0 or z == result.len - 1 or result[0 ..< z] notin LibDirs: break
+    result = result[z+1 .. ^1]
+
+proc indexProc(self: SymbolMap, mangled, demangled: string) =
+  self.procsByName.mgetOrPut(demangled, @[]).add(mangled)
+  let module = nimModuleOf(mangled)
+  if module.len > 0:
+    self.procsByName.mgetOrPut(module & "." & demangled, @[]).add(mangled)
+
+proc addFunction*(self: SymbolMap, mangled: string) =
+  ## Like addGlobal, but also indexes the symbol as a proc instantiation
+  let known = self.globalMangledToDemangled.hasKey(mangled)
+  self.addGlobal(mangled)
+  if not known and self.globalMangledToDemangled.hasKey(mangled):
+    self.indexProc(mangled, self.globalMangledToDemangled[mangled])
+
+proc procInstances*(self: SymbolMap, name: string): seq[string] =
+  ## All mangled instantiations of a proc, by "proc" or "module.proc"
+  return self.procsByName.getOrDefault(name, @[])
 
 proc clearLocals*(self: SymbolMap) =
   self.localDemangledToMangled.clear()
+  self.localNormalized.clear()
+
+proc useLocalScope*(self: SymbolMap, scope: string) =
+  ## Makes `scope`'s locals the active ones, keeping the current set aside.
+  ## In non-stop mode each thread has its own scope.
+  if scope == self.localScope: return
+  self.localScopes[self.localScope] = LocalScope(demangledToMangled: move(self.localDemangledToMangled),
+                                                 normalized: move(self.localNormalized))
+  var next: LocalScope
+  if self.localScopes.pop(scope, next):
+    self.localDemangledToMangled = move(next.demangledToMangled)
+    self.localNormalized = move(next.normalized)
+  else:
+    self.localDemangledToMangled = initTable[string, string]()
+    self.localNormalized = initTable[string, string]()
+  self.localScope = scope
 
 proc addLocal*(self: SymbolMap, mangled: string) =
   let demangled = self.demangle(mangled)
   if demangled != mangled:
     self.localDemangledToMangled[demangled] = mangled
+    if demangled.len > 0 and demangled[0] != '[':
+      self.localNormalized[normalizeIdent(demangled)] = demangled
 
-proc getMangled*(self: SymbolMap, demangled: string): string =
+proc getMangled*(self: SymbolMap, demangled: string, root: bool = false): string =
+  ## C name for `demangled`. Only a `root` (an identifier that starts an
+  ## expression, not a field or member after it) falls back to the
+  ## style-insensitive index.
   # Handle reverse mapping for special demangled names
   if demangled == "[StackFrame]":
     return "FR_"
@@ -151,8 +327,22 @@ proc getMangled*(self: SymbolMap, demangled: string): string =
     for mangled in candidates:
       if mangled.len < best.len:
         best = mangled
+    if best in self.renamedInDwarf:
+      return demangled
     return best
   
+  # Nim is style-insensitive: `my_var` and `myvar` both mean `myVar`
+  if root and demangled.len > 0 and demangled[0] != '[':
+    let key = normalizeIdent(demangled)
+    if self.localNormalized.hasKey(key) and self.localNormalized[key] != demangled:
+      return self.getMangled(self.localNormalized[key])
+    if self.globalNormalized.hasKey(key):
+      let spellings = self.globalNormalized[key]
+      if spellings.len > 1 and self.styleCollisionHook != nil:
+        self.styleCollisionHook(demangled, spellings)
+      if spellings[0] != demangled:
+        return self.getMangled(spellings[0])
+  
   # If not found, try to construct parameter name with _p0
   # (common default for first parameter)
   return demangled
@@ -162,6 +352,27 @@ proc loadFromBinary*(self: SymbolMap, binaryPath: string): bool =
   if not fileExists(binaryPath):
     return false
   
+  # Symbols are collected first so the mangling scheme can be picked
+  # before anything is demangled
+  var symbols: seq[tuple[address, name: string, isFunction: bool]] = @[]
+  proc addSymbols() =
+    var names = newSeqOfCap[string](symbols.len)
+    for sym in symbols:
+      names.add(sym.name)
+    self.setScheme(detectScheme(names))
+    for sym in symbols:
+      if sym.isFunction:
+        self.addFunction(sym.name)
+      else:
+        self.addGlobal(sym.name)
+      if self.globalMangledToDemangled.hasKey(sym.name):
+        self.addresses[sym.name] = "0x" & sym.address
+      elif not sym.name.contains('.'):
+        self.plainSymbols[sym.name] = sym.isFunction
+        self.addresses[sym.name] = "0x" & sym.address
+    self.kindsKnown = true
+    inc self.generation
+
   # Helper to parse nm output
   proc parseNmOutput(output: string) =
     for line in output.splitLines:
@@ -170,18 +381,19 @@ proc loadFromBinary*(self: SymbolMap, binaryPath: string): bool =
       if parts.len >= 3:
         let name = parts[2]
         if name.len > 0 and not name.startsWith("."):
-          self.addGlobal(name)
+          symbols.add((parts[0], name, parts[1] in ["T", "t", "W", "w"]))
+    addSymbols()
   
   # Try nm first (fastest)
   try:
     # Try with demangling
-    let (outp1, code1) = execCmdEx("nm --demangle --defined-only " & binaryPath & " 2>/dev/null")
+    let (outp1, code1) = execCmdEx("nm --demangle --defined-only " & quoteShell(binaryPath) & " 2>/dev/null")
     if code1 == 0 and outp1.len > 0:
       parseNmOutput(outp1)
       return true
     
     # Try without demangling
-    let (outp2, code2) = execCmdEx("nm --defined-only " & binaryPath & " 2>/dev/null")
+    let (outp2, code2) = execCmdEx("nm --defined-only " & quoteShell(binaryPath) & " 2>/dev/null")
     if code2 == 0 and outp2.len > 0:
       parseNmOutput(outp2)
       return true
@@ -190,7 +402,7 @@ proc loadFromBinary*(self: SymbolMap, binaryPath: string): bool =
   
   # Fallback to objdump
   try:
-    let (outp, code) = execCmdEx("objdump -t " & binaryPath & " 2>/dev/null")
+    let (outp, code) = execCmdEx("objdump -t " & quoteShell(binaryPath) & " 2>/dev/null")
     if code == 0:
       for line in outp.splitLines:
         if line.len < 30: continue
@@ -199,13 +411,77 @@ proc loadFromBinary*(self: SymbolMap, binaryPath: string): bool =
           if parts.len >= 6:
             let name = parts[^1]
             if name.len > 0 and not name.startsWith("."):
-              self.addGlobal(name)
+              symbols.add((parts[0], name, " F " in line))
+      addSymbols()
       return true
   except OSError:
     discard
   
   return false
 
+# ----- Snapshots -----
+# A flat, line-oriented dump of an already demangled map. The symbol service
+# writes one per build-id; sessions read it instead of running nm and
+# demangling, but still build their own tables from it. Format: a "nimdbg-symbols 1 <scheme>" header, then
+# "<F|G>\t<mangled>\t<demangled>\t<address>" per global, and
+# "<f|g>\t<name>\t\t<address>" per plain (not Nim-mangled) symbol.
+
+const SnapshotHeader = "nimdbg-symbols 1 "
+
+proc saveSnapshot*(self: SymbolMap, path: string) =
+  var functions = initTable[string, bool]()
+  for instances in self.procsByName.values:
+    for mangled in instances:
+      functions[mangled] = true
+  var f = open(path & ".tmp", fmWrite)
+  f.write(SnapshotHeader & $self.scheme & "\n")
+  for mangled, demangled in self.globalMangledToDemangled:
+    f.write((if functions.hasKey(mangled): "F" else: "G") & "\t" & mangled & "\t" & demangled & "\t" &
+            self.addresses.getOrDefault(mangled, "") & "\n")
+  for name, isFunction in self.plainSymbols:
+    f.write((if isFunction: "f" else: "g") & "\t" & name & "\t\t" & self.addresses.getOrDefault(name, "") & "\n")
+  f.close()
+  moveFile(path & ".tmp", path)  # readers never see a partial snapshot
+
+proc loadFromSnapshot*(self: SymbolMap, path: string): bool =
+  ## Fills the tables from a snapshot, read once through a read-only mapping.
+  ## Every entry is copied; the mapping is closed before returning.
+  var mf: MemFile
+  try:
+    mf = memfiles.open(path, mode = fmRead)
+  except OSError:
+    return false
+  defer: mf.close()
+
+  var first = true
+  for line in lines(mf):
+    if first:
+      first = false
+      if not line.startsWith(SnapshotHeader): return false
+      try:
+        self.setScheme(parseEnum[ManglingScheme](line[SnapshotHeader.len .. ^1]))
+      except ValueError:
+        return false
+      continue
+    let parts = line.split('\t')
+    if parts.len != 4: continue
+    let (mangled, demangled) = (parts[1], parts[2])
+    if parts[3].len > 0:
+      self.addresses[mangled] = parts[3]
+    if parts[0] in ["f", "g"]:
+      self.plainSymbols[mangled] = parts[0] == "f"
+      continue
+    self.globalMangledToDemangled[mangled] = demangled
+    if not self.globalDemangledToMangled.hasKey(demangled):
+      self.globalDemangledToMangled[demangled] = @[]
+      self.indexGlobalStyle(demangled)
+    self.globalDemangledToMangled[demangled].add(mangled)
+    if parts[0] == "F":
+      self.indexProc(mangled, demangled)
+  self.kindsKnown = true
+  inc self.generation
+  return not first
+
 proc loadFromGdbInfo*(self: SymbolMap, gdbOutput: string) =
   ## Parse GDB 'info locals' and 'info args' output
   self.clearLocals()
@@ -258,6 +534,13 @@ proc loadFromFile*(self: SymbolMap, filepath: string): bool =
     self.globalMangledToDemangled.clear()
     self.globalDemangledToMangled.clear()
     self.localDemangledToMangled.clear()
+    self.procsByName.clear()
+    self.addresses.clear()
+    self.plainSymbols.clear()
+    self.globalNormalized.clear()
+    self.localNormalized.clear()
+    self.kindsKnown = false
+    inc self.generation
     
     if "global" in j:
       for mangled, demangled in j["global"]:
@@ -266,11 +549,16 @@ proc loadFromFile*(self: SymbolMap, filepath: string): bool =
         self.globalMangledToDemangled[mangledStr] = demangledStr
         if not self.globalDemangledToMangled.hasKey(demangledStr):
           self.globalDemangledToMangled[demangledStr] = @[]
+          self.indexGlobalStyle(demangledStr)
         self.globalDemangledToMangled[demangledStr].add(mangledStr)
+        # The JSON format does not record symbol kinds, so index everything
+        self.indexProc(mangledStr, demangledStr)
     
     if "local" in j:
       for demangled, mangled in j["local"]:
         self.localDemangledToMangled[demangled] = mangled.getStr
+        if demangled.len > 0 and demangled[0] != '[':
+          self.localNormalized[normalizeIdent(demangled)] = demangled
     
     return true
     
@@ -0,0 +1,374 @@
+## Symbol search answered by the proxy from a trigram index.
+##
+## `-symbol-info-functions --name REGEX`, `-symbol-info-variables` and the
+## console `info functions` / `info variables` commands only know mangled
+## names, and walk GDB's full symbol tables to find them. The proxy answers
+## them from a trigram index over demangled, mangled and plain C names instead:
+## literal runs of the regex select candidates, and only those candidates are
+## matched against the regex itself. REGEX is a POSIX basic regex, as in GDB,
+## translated to PCRE. Hits are grouped by source file like GDB's replies;
+## the file and line of each hit come from `addr2line` on its address, once
+## per address. Queries the index cannot answer (`--type`, JSON maps without
+## kinds or addresses) go to GDB.
+
+import std/[tables, sets, strutils, re, algorithm, osproc, os]
+import symbol_map, mi_parser
+
+type
+  SymbolEntry* = object
+    mangled*: string
+    demangled*: string
+    isFunction*: bool
+
+  SourceLocation* = tuple[file: string, line: int]  # ("", 0) without line info
+
+  SymbolSearch* = ref object
+    sm: SymbolMap
+    entries: seq[SymbolEntry]
+    postings: Table[uint32, seq[int32]]  # trigram -> ascending entry ids
+    indexedGeneration: int
+    binaryPath*: string                  # for addr2line; "" leaves every hit without a file
+    locations*: Table[string, SourceLocation]  # address -> where addr2line put it
+
+proc trigram(s: string, i: int): uint32 =
+  return (s[i].uint32 shl 16) or (s[i+1].uint32 shl 8) or s[i+2].uint32
+
+proc newSymbolSearch*(sm: SymbolMap, binaryPath = ""): SymbolSearch =
+  new(result)
+  result.sm = sm
+  result.binaryPath = binaryPath
+  result.postings = initTable[uint32, seq[int32]]()
+  result.locations = initTable[string, SourceLocation]()
+  result.indexedGeneration = -1
+
+proc indexName(search: SymbolSearch, id: int32, name: string) =
+  for i in 0 .. name.len - 3:
+    let key = trigram(name, i)
+    if key notin search.postings:
+      search.postings[key] = @[id]
+    elif search.postings[key][^1] != id:
+      search.postings[key].add(id)
+
+proc refresh*(search: SymbolSearch) =
+  ## Rebuilds the index after symbols were (re)loaded
+  if search.indexedGeneration == search.sm.generation: return
+  search.entries.setLen(0)
+  search.postings.clear()
+
+  var functions = initHashSet[string]()
+  for instances in search.sm.procsByName.values:
+    for mangled in instances:
+      functions.incl(mangled)
+
+  for mangled, demangled in search.sm.globalMangledToDemangled:
+    let id = search.entries.len.int32
+    search.entries.add(SymbolEntry(mangled: mangled, demangled: demangled,
+                                   isFunction: mangled in functions))
+    search.indexName(id, mangled)
+    search.indexName(id, demangled)
+  for name, isFunction in search.sm.plainSymbols:
+    let id = search.entries.len.int32
+    search.entries.add(SymbolEntry(mangled: name, demangled: name, isFunction: isFunction))
+    search.indexName(id, name)
+  search.indexedGeneration = search.sm.generation
+
+proc requiredLiterals*(pattern: string): seq[string] =
+  ## Literal runs that every match of `pattern` must contain. Conservative:
+  ## alternations yield nothing, and groups, classes and escapes only split runs.
+  if '|' in pattern: return @[]
+  var run = ""
+  var depth = 0
+  var i = 0
+  template flush() =
+    if run.len > 0 and depth == 0:
+      result.add(run)
+    run = ""
+  while i < pattern.len:
+    let c = pattern[i]
+    case c
+    of '\\':
+      flush()
+      i += 2
+    of '[':
+      flush()
+      i += 1
+      if i < pattern.len and pattern[i] == ']': i += 1
+      while i < pattern.len and pattern[i] != ']': i += 1
+      i += 1
+    of '*', '?', '{':
+      # The previous character is optional
+      if run.len > 0: run.setLen(run.len - 1)
+      flush()
+      if c == '{':
+        while i < pattern.len and pattern[i] != '}': i += 1
+      i += 1
+    of '(':
+      flush()
+      inc depth
+      i += 1
+    of ')':
+      flush()
+      if depth > 0: dec depth
+      i += 1
+    of '.', '^', '$', '+':
+      flush()
+      i += 1
+    else:
+      if depth == 0: run.add(c)
+      i += 1
+  flush()
+
+proc intersect(a, b: seq[int32]): seq[int32] =
+  var i, j = 0
+  while i < a.len and j < b.len:
+    if a[i] < b[j]: inc i
+    elif a[i] > b[j]: inc j
+    else:
+      result.add(a[i])
+      inc i
+      inc j
+
+proc query*(search: SymbolSearch, pattern: string, functions: bool, limit: int = high(int)): seq[SymbolEntry] =
+  ## Functions (or variables) whose demangled or mangled name matches `pattern`.
+  ## Raises RegexError for patterns PCRE cannot compile.
+  search.refresh()
+  let rx = re(pattern)
+
+  var keys: seq[uint32] = @[]
+  for literal in requiredLiterals(pattern):
+    for i in 0 .. literal.len - 3:
+      let key = trigram(literal, i)
+      if key notin search.postings: return @[]
+      keys.add(key)
+  keys.sort(proc(a, b: uint32): int = cmp(search.postings[a].len, search.postings[b].len))
+
+  var candidates: seq[int32] = @[]
+  if keys.len > 0:
+    candidates = search.postings[keys[0]]
+    for key in keys[1 .. ^1]:
+      candidates = intersect(candidates, search.postings[key])
+      if candidates.len == 0: return @[]
+  else:
+    for id in 0 ..< search.entries.len:
+      candidates.add(id.int32)
+
+  for id in candidates:
+    let entry = search.entries[id]
+    if entry.isFunction != functions: continue
+    if entry.demangled.contains(rx) or entry.mangled.contains(rx):
+      result.add(entry)
+  result.sort(proc(a, b: SymbolEntry): int = cmp(a.demangled, b.demangled))
+  if result.len > limit:
+    result.setLen(limit)
+
+proc useBinary*(search: SymbolSearch, path: string) =
+  ## Where file and line of later hits come from; earlier lookups are dropped
+  search.binaryPath = path
+  search.locations.clear()
+
+proc breToPcre*(pattern: string): string =
+  ## GDB's symbol regexes are POSIX basic regexes with GNU extensions: `\(`,
+  ## `\|`, `\{`, `\+`, `\?` are operators and the bare characters literals
+  var i = 0
+  var atStart = true  # where `*` is literal and `^` an anchor
+  while i < pattern.len:
+    let c = pattern[i]
+    let wasStart = atStart
+    atStart = false
+    case c
+    of '\\':
+      if i + 1 >= pattern.len:
+        result.add("\\\\")
+        break
+      let n = pattern[i + 1]
+      case n
+      of '(', '|':
+        result.add(n)
+        atStart = true
+      of ')', '{', '}', '+', '?': result.add(n)
+      of '<', '>': result.add("\\b")
+      of 'w', 'W', 's', 'S', 'b', 'B': result.add("\\" & n)
+      of '1' .. '9': result.add("\\" & n)
+      else:
+        if n in IdentChars: result.add(n)
+        else: result.add("\\" & n)
+      i += 2
+      continue
+    of '[':
+      # Bracket expressions copy through; backslash is literal inside them
+      var j = i + 1
+      if j < pattern.len and pattern[j] == '^': inc j
+      if j < pattern.len and pattern[j] == ']': inc j
+      while j < pattern.len and pattern[j] != ']':
+        if pattern[j] == '[' and j + 1 < pattern.len and pattern[j + 1] in {':', '.', '='}:
+          let close = pattern.find(pattern[j + 1] & "]", j + 2)
+          if close > 0: j = close + 1
+          else: inc j
+        else:
+          inc j
+      result.add(pattern[i .. min(j, pattern.len - 1)].replace("\\", "\\\\"))
+      i = j + 1
+      continue
+    of '*':
+      result.add(if wasStart: "\\*" else: "*")
+    of '^':
+      if wasStart:
+        result.add('^')
+        atStart = true
+      else:
+        result.add("\\^")
+    of '$':
+      let atEnd = i == pattern.len - 1 or pattern.continuesWith("\\)", i + 1) or
+                  pattern.continuesWith("\\|", i + 1)
+      result.add(if atEnd: "$" else: "\\$")
+    of '(', ')', '|', '{', '}', '+', '?':
+      result.add("\\" & c)
+    else:
+      result.add(c)
+    inc i
+
+proc locate(search: SymbolSearch, entries: seq[SymbolEntry]) =
+  ## Fills `locations` for the entries' addresses not looked up yet
+  var missing: seq[string] = @[]
+  for entry in entries:
+    let address = search.sm.addresses.getOrDefault(entry.mangled, "")
+    if address.len > 0 and address notin search.locations and address notin missing:
+      missing.add(address)
+  if missing.len == 0: return
+  var output = ""
+  if search.binaryPath.len > 0 and fileExists(search.binaryPath):
+    try:
+      let (text, code) = execCmdEx("addr2line -e " & quoteShell(search.binaryPath),
+                                   input = missing.join("\n") & "\n")
+      if code == 0: output = text
+    except OSError:
+      discard
+  let lines = output.splitLines()
+  for i, address in missing:
+    var location: SourceLocation = ("", 0)
+    if i < lines.len:
+      let colon = lines[i].rfind(':')
+      if colon > 0 and not lines[i].startsWith("??"):
+        try:
+          location = (lines[i][0 ..< colon], parseInt(lines[i][colon + 1 .. ^1].split(' ')[0]))
+        except ValueError:
+          discard
+    search.locations[address] = location
+
+type SymbolGroups = object
+  files: seq[(string, seq[(int, string)])]  # file -> (line, name), both sorted
+  nondebug: seq[(string, string)]           # (address, name)
+
+proc group(search: SymbolSearch, found: seq[SymbolEntry]): SymbolGroups =
+  search.locate(found)
+  var byFile = initTable[string, seq[(int, string)]]()
+  for entry in found:
+    let address = search.sm.addresses.getOrDefault(entry.mangled, "")
+    let location = search.locations.getOrDefault(address)
+    if location.file.len > 0:
+      byFile.mgetOrPut(location.file, @[]).add((location.line, entry.demangled))
+    else:
+      result.nondebug.add((address, entry.demangled))
+  for file, symbols in byFile.mpairs:
+    symbols.sort(proc(a, b: (int, string)): int = cmp((a[1], a[0]), (b[1], b[0])))
+    result.files.add((file, symbols))
+  result.files.sort(proc(a, b: (string, seq[(int, string)])): int = cmp(a[0], b[0]))
+
+proc matching(search: SymbolSearch, brePattern: string, functions: bool): seq[SymbolEntry] =
+  ## Raises RegexError like `query`
+  return search.query(if brePattern.len > 0: breToPcre(brePattern) else: ".", functions)
+
+proc answerMi(search: SymbolSearch, token: string, args: seq[string]): string =
+  var pattern = ""
+  var includeNondebug = false
+  var limit = high(int)
+  var i = 1
+  while i < args.len:
+    case args[i]
+    of "--name":
+      if i + 1 >= args.len: return ""
+      pattern = args[i + 1]
+      inc i
+    of "--max-results":
+      if i + 1 >= args.len: return ""
+      try:
+        limit = parseInt(args[i + 1])
+      except ValueError:
+        return ""
+      inc i
+    of "--include-nondebug": includeNondebug = true
+    else: return ""  # --type and anything newer: GDB's business
+    inc i
+
+  var found: seq[SymbolEntry]
+  try:
+    found = search.matching(pattern, args[0] == "-symbol-info-functions")
+  except RegexError:
+    return ""
+  let groups = search.group(found)
+
+  var debug: seq[string] = @[]
+  var reported = 0
+  for (file, symbols) in groups.files:
+    var items: seq[string] = @[]
+    for (line, name) in symbols:
+      if reported >= limit: break
+      items.add("{line=\"" & $line & "\",name=\"" & escapeMi(name) & "\"}")
+      inc reported
+    if items.len > 0:
+      debug.add("{filename=\"" & escapeMi(file) & "\",fullname=\"" & escapeMi(absolutePath(file)) &
+                "\",symbols=[" & items.join(",") & "]}")
+  result = token & "^done,symbols={debug=[" & debug.join(",") & "]"
+  if includeNondebug:
+    var items: seq[string] = @[]
+    for (address, name) in groups.nondebug:
+      if reported >= limit: break
+      items.add("{address=\"" & address & "\",name=\"" & escapeMi(name) & "\"}")
+      inc reported
+    result.add(",nondebugging=[" & items.join(",") & "]")
+  result.add("}")
+
+proc answerConsole(search: SymbolSearch, token: string, command: string): seq[string] =
+  let words = command.splitWhitespace(maxsplit = 2)
+  if words.len < 2 or words[0] != "info" or words[1] notin ["functions", "variables"]:
+    return @[]
+  let functions = words[1] == "functions"
+  let pattern = if words.len == 3: words[2].strip() else: ""
+  if pattern.startsWith("-"): return @[]  # -q/-n/-t flags
+
+  var found: seq[SymbolEntry]
+  try:
+    found = search.matching(pattern, functions)
+  except RegexError:
+    return @[]
+  let groups = search.group(found)
+
+  template say(text: string) =
+    result.add("~\"" & escapeMi(text) & "\"")
+  let kind = if functions: "functions" else: "variables"
+  if pattern.len > 0: say("All " & kind & " matching regular expression \"" & pattern & "\":\n")
+  else: say("All defined " & kind & ":\n")
+  for (file, symbols) in groups.files:
+    say("\nFile " & file & ":\n")
+    for (line, name) in symbols:
+      say($line & ":\t" & name & "\n")
+  if groups.nondebug.len > 0:
+    say("\nNon-debugging symbols:\n")
+    for (address, name) in groups.nondebug:
+      say(address & "  " & name & "\n")
+  result.add(token & "^done")
+
+proc answer*(search: SymbolSearch, line: string): seq[string] =
+  ## Records answering a symbol search, or nothing when GDB should handle it
+  ## (options the index cannot evaluate, invalid regexes, JSON maps, other
+  ## commands)
+  if not search.sm.kindsKnown: return @[]  # a JSON map has neither kinds nor addresses
+  let token = miToken(line)
+  let args = miArgs(stripToken(line))
+  if args.len == 0: return @[]
+  if args[0] in ["-symbol-info-functions", "-symbol-info-variables"]:
+    let reply = search.answerMi(token, args)
+    return if reply.len > 0: @[reply] else: @[]
+  if args.len == 3 and args[0] == "-interpreter-exec" and args[1] == "console":
+    return search.answerConsole(token, args[2])
+  return @[]
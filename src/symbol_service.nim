@@ -0,0 +1,146 @@
+## Shared symbol service.
+##
+## `nim_debugger_mi symbol-service` is a long-lived daemon on a Unix socket.
+## Each session asks it for the symbols of its binary; the daemon runs nm and
+## demangles once per build-id and answers with the path of a snapshot in the
+## user cache directory. Sessions load the snapshot instead of running nm and
+## demangling themselves. Each session still builds its own tables from it;
+## only the file itself is shared, through the page cache.
+##
+## The default socket is in a private per-user directory. To share one service
+## between users, run it with `--socket` and `--snapshot-dir` in a directory
+## owned by the service's user and writable only by a common group. Sessions
+## only talk to sockets owned by themselves or by that directory's owner; the
+## service only answers its own user and members of that directory's group
+## (SO_PEERCRED), and only for regular ELF files.
+##
+## Protocol, one line each way: `SNAPSHOT <binary path>` -> `OK <snapshot path>`
+## or `ERR <message>`.
+
+import std/[os, strutils]
+import symbol_map, build_id
+
+when defined(posix):
+  import std/net
+
+type
+  SymbolServiceOptions = object
+    socketPath: string
+    snapshotDir: string
+
+proc defaultSocketPath*(): string =
+  return runtimeDir() / "symbols.sock"
+
+proc snapshotPath*(binaryPath: string, dir = ""): string =
+  ## Where the snapshot of `binaryPath` lives in `dir` (the user cache by
+  ## default), or "" if the binary does not exist
+  let id = buildId(binaryPath)
+  if id.len == 0: return ""
+  return (if dir.len > 0: dir else: cacheDir("symbols")) / (id & ".syms")
+
+proc isElfFile*(path: string): bool =
+  ## A regular file starting with the ELF magic
+  try:
+    if getFileInfo(path).kind != pcFile: return false
+    var f = open(path)
+    defer: f.close()
+    var magic: array[4, char]
+    return f.readChars(magic) == 4 and magic == ['\x7F', 'E', 'L', 'F']
+  except OSError, IOError:
+    return false
+
+proc buildSnapshot*(binaryPath: string, dir = ""): string =
+  ## Snapshot path for `binaryPath`, writing it first if needed
+  if not isElfFile(binaryPath): raise newException(IOError, "not an ELF file: " & binaryPath)
+  result = snapshotPath(binaryPath, dir)
+  if result.len == 0: raise newException(IOError, "no such binary: " & binaryPath)
+  if fileExists(result): return
+  let sm = newSymbolMap()
+  if not sm.loadFromBinary(binaryPath):
+    raise newException(IOError, "could not read symbols of " & binaryPath)
+  sm.saveSnapshot(result)
+
+proc answer(request, snapshotDir: string): string =
+  let parts = request.strip().split(' ', maxsplit = 1)
+  if parts.len != 2 or parts[0] != "SNAPSHOT":
+    return "ERR unknown request"
+  try:
+    return "OK " & buildSnapshot(parts[1], snapshotDir)
+  except IOError, OSError:
+    return "ERR " & getCurrentExceptionMsg().replace('\n', ' ')
+
+proc requestSnapshot*(socketPath, binaryPath: string): string =
+  ## Snapshot path from a running service, or "" if none answers
+  when defined(posix):
+    if not trustedSocket(socketPath): return ""
+    var socket = newSocket(AF_UNIX, SOCK_STREAM, IPPROTO_IP)
+    try:
+      socket.connectUnix(socketPath)
+      socket.send("SNAPSHOT " & absolutePath(binaryPath) & "\n")
+      let reply = socket.recvLine(timeout = 30_000)
+      if reply.startsWith("OK "): return reply[3 .. ^1]
+    except OSError, TimeoutError:
+      discard
+    finally:
+      socket.close()
+  return ""
+
+proc parseServiceArgs(args: seq[string]): SymbolServiceOptions =
+  let quotes = {'"', '\'', ' ', '`'}
+  for arg in args:
+    if arg.startswith("--socket=") or arg.startswith("--socket:"):
+      result.socketPath = arg[9 .. ^1].strip(chars = quotes).expandTilde
+    elif arg.startswith("--snapshot-dir=") or arg.startswith("--snapshot-dir:"):
+      result.snapshotDir = arg[15 .. ^1].strip(chars = quotes).expandTilde
+      createDir(result.snapshotDir)
+    else:
+      raise newException(ValueError, arg)
+
+proc runSymbolService*(args: seq[string]): int =
+  var opts: SymbolServiceOptions
+  try:
+    opts = parseServiceArgs(args)
+    if opts.socketPath.len == 0: opts.socketPath = defaultSocketPath()
+  except ValueError as e:
+    stderr.writeLine("Invalid symbol-service argument: " & e.msg)
+    stderr.writeLine("Usage: nim_debugger_mi symbol-service [--socket=PATH] [--snapshot-dir=DIR]")
+    return 1
+  except OSError as e:
+    stderr.writeLine("Symbol service: " & e.msg)
+    return 1
+  when defined(posix):
+    if fileExists(opts.socketPath) or symlinkExists(opts.socketPath):
+      removeFile(opts.socketPath)  # left over from a service that did not shut down
+    var server = newSocket(AF_UNIX, SOCK_STREAM, IPPROTO_IP)
+    defer:
+      server.close()
+      removeFile(opts.socketPath)
+    server.bindUnix(opts.socketPath)
+    shareSocket(opts.socketPath)
+    server.listen()
+    stderr.writeLine("Symbol service listening on " & opts.socketPath)
+
+    while true:
+      var client: Socket
+      try:
+        new(client)
+        server.accept(client)
+      except OSError as e:
+        stderr.writeLine("Symbol service accept failed: " & e.msg)
+        continue
+      if not allowedPeer(client.getFd, opts.socketPath):
+        stderr.writeLine("Symbol service: refused a client of uid " & $peerUid(client.getFd))
+        client.close()
+        continue
+      try:
+        let request = client.recvLine(timeout = 5_000)
+        let reply = answer(request, opts.snapshotDir)
+        client.send(reply & "\n")
+        stderr.writeLine(request & " -> " & reply)
+      except OSError, TimeoutError:
+        discard
+      finally:
+        client.close()
+  else:
+    stderr.writeLine("The symbol service needs Unix domain sockets")
+    return 1
@@ -0,0 +1,114 @@
+## Breakpoint conditions evaluated on the target.
+##
+## Normally GDB stops the inferior on every hit of a conditional breakpoint
+## and evaluates the condition itself, which makes a breakpoint in a hot loop
+## very slow. With `--target-conditions` the proxy runs the inferior under a
+## local `gdbserver` (extended-remote over a pipe) and sets
+## `breakpoint condition-evaluation target`, so gdbserver evaluates the
+## condition as an agent expression and only reports hits where it holds.
+## Nim operators are turned into C ones first so the condition compiles.
+## Conditions the agent cannot run (calls, strings) fall back to GDB.
+
+import std/[strutils]
+import mi_parser, internal_commands
+
+type
+  TargetConditions* = ref object
+    commands: InternalCommands
+    log: proc(message: string) {.closure.}
+    gdbserverPath: string
+    programPath*: string
+    started: bool
+
+const NimOperators = [("and", "&&"), ("or", "||"), ("not", "!"), ("xor", "^"), ("mod", "%"),
+                      ("div", "/"), ("shl", "<<"), ("shr", ">>"), ("nil", "0"),
+                      ("true", "1"), ("false", "0")]
+
+proc newTargetConditions*(commands: InternalCommands, gdbserverPath, programPath: string,
+                          log: proc(message: string) {.closure.}): TargetConditions =
+  new(result)
+  result.commands = commands
+  result.gdbserverPath = gdbserverPath
+  result.programPath = programPath
+  result.log = log
+
+proc nimConditionToC*(expr: string): string =
+  ## `a and not b` -> `a && ! b`; string and char literals are left alone
+  result = newStringOfCap(expr.len + 8)
+  var i = 0
+  while i < expr.len:
+    let c = expr[i]
+    if c in {'"', '\''}:
+      var j = i + 1
+      while j < expr.len and expr[j] != c:
+        if expr[j] == '\\': inc j
+        inc j
+      result.add(expr[i .. min(j, expr.len - 1)])
+      i = j + 1
+    elif c in IdentStartChars and (i == 0 or expr[i-1] notin IdentChars + {'.', '>'}):
+      var j = i
+      while j < expr.len and expr[j] in IdentChars:
+        inc j
+      let word = expr[i ..< j]
+      var replaced = word
+      for (nimOp, cOp) in NimOperators:
+        if word == nimOp:
+          replaced = cOp
+          break
+      result.add(replaced)
+      i = j
+    else:
+      result.add(c)
+      inc i
+
+proc rewriteCondition(line: string): string =
+  let token = miToken(line)
+  let parts = stripToken(line).splitWhitespace()
+  if parts.len == 0: return line
+  case parts[0]
+  of "-break-condition":
+    # -break-condition [--force] N expr
+    var i = 1
+    while i < parts.len and parts[i].startsWith("--"): inc i
+    if i + 1 >= parts.len: return line
+    return token & (parts[0 .. i] & @[nimConditionToC(parts[i+1 .. ^1].join(" "))]).join(" ")
+  of "-break-insert", "-dprintf-insert":
+    let c = line.find(" -c ")
+    if c == -1: return line
+    var start = c + 4
+    if start < line.len and line[start] == '"':
+      var j = start + 1
+      while j < line.len and line[j] != '"':
+        if line[j] == '\\': inc j
+        inc j
+      if j >= line.len: return line
+      let condition = escapeMi(nimConditionToC(unescapeMi(line[start + 1 ..< j])))
+      return line[0 .. start] & condition & line[j .. ^1]
+    var j = start
+    while j < line.len and line[j] notin Whitespace: inc j
+    return line[0 ..< start] & nimConditionToC(line[start ..< j]) & line[j .. ^1]
+  else:
+    return line
+
+proc start(tc: TargetConditions) =
+  ## Moves the session onto a local gdbserver before the first run
+  tc.started = true
+  let setup = @[
+    "-gdb-set breakpoint condition-evaluation target",
+    "-interpreter-exec console \"" & escapeMi("target extended-remote | " & tc.gdbserverPath & " --multi -") & "\"",
+    "-gdb-set remote exec-file \"" & escapeMi(tc.programPath) & "\""]
+  for command in setup:
+    let sent = command
+    discard tc.commands.send(sent, proc(reply: string) =
+      if isErrorRecord(reply):
+        tc.log("Target-side conditions unavailable (" & sent & "): " & miField(reply, "msg"))
+    )
+
+proc rewrite*(tc: TargetConditions, line: string): string =
+  ## Converts Nim conditions to C and switches to gdbserver at the first run
+  let command = stripToken(line)
+  if command.startsWith("-file-exec-and-symbols "):
+    tc.programPath = command["-file-exec-and-symbols ".len .. ^1].strip(chars = {'"', ' '})
+  elif command.startsWith("-exec-run") and not tc.started and tc.programPath.len > 0:
+    tc.start()
+  return rewriteCondition(line)
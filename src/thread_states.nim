@@ -0,0 +1,74 @@
+## Per-thread run state, and GDB non-stop mode.
+##
+## In all-stop mode every thread stops at each breakpoint. With `--non-stop`
+## the proxy switches GDB to `mi-async` + `non-stop`, so only the thread that
+## hit a breakpoint stops and the other workers keep serving. The proxy then
+## tracks which threads are stopped: the memory cache is only used while no
+## thread runs, locals are learned per thread, and `-exec-interrupt` (the
+## IDE's pause button) interrupts every thread.
+
+import std/[tables, strutils]
+import mi_parser
+
+const NonStopSetup* = ["-gdb-set mi-async on", "-gdb-set non-stop on"]
+
+type
+  ThreadStates* = ref object
+    nonStop*: bool
+    running: Table[string, bool]  # thread id -> running
+
+proc newThreadStates*(nonStop: bool = false): ThreadStates =
+  new(result)
+  result.nonStop = nonStop
+  result.running = initTable[string, bool]()
+
+proc setAll(ts: ThreadStates, running: bool) =
+  for thread in ts.running.mvalues:
+    thread = running
+
+proc stoppedThreads(line: string): seq[string] =
+  ## `stopped-threads=["1","3"]` -> @["1", "3"]; `"all"` -> @["all"]
+  let start = line.find("stopped-threads=")
+  if start == -1: return @[]
+  var i = start + "stopped-threads=".len
+  if i < line.len and line[i] == '"':
+    return @[miField(line, "stopped-threads")]
+  if i >= line.len or line[i] != '[': return @[]
+  let close = line.find(']', i)
+  if close == -1: return @[]
+  for item in line[i + 1 ..< close].split(','):
+    let id = item.strip(chars = {'"', ' '})
+    if id.len > 0: result.add(id)
+
+proc observe*(ts: ThreadStates, line: string) =
+  if line.startsWith("=thread-created"):
+    ts.running[miField(line, "id")] = true
+  elif line.startsWith("=thread-exited"):
+    ts.running.del(miField(line, "id"))
+  elif line.startsWith("*running"):
+    let thread = miField(line, "thread-id")
+    if thread == "all" or thread.len == 0: ts.setAll(true)
+    else: ts.running[thread] = true
+  elif line.startsWith("*stopped"):
+    var stopped = stoppedThreads(line)
+    if stopped.len == 0:
+      let thread = miField(line, "thread-id")
+      stopped = if thread.len > 0 and ts.nonStop: @[thread] else: @["all"]
+    for thread in stopped:
+      if thread == "all": ts.setAll(false)
+      else: ts.running[thread] = false
+
+proc isRunning*(ts: ThreadStates, thread: string): bool =
+  return ts.running.getOrDefault(thread, false)
+
+proc anyRunning*(ts: ThreadStates): bool =
+  for running in ts.running.values:
+    if running: return true
+  return false
+
+proc rewrite*(ts: ThreadStates, line: string): string =
+  ## In non-stop mode a bare -exec-interrupt only stops the selected thread;
+  ## the IDE's pause means all of them
+  if ts.nonStop and stripToken(line) == "-exec-interrupt":
+    return line & " --all"
+  return line
@@ -0,0 +1,226 @@
+## Batch core-dump triage.
+##
+## `nim_debugger_mi triage --binary X cores/*` runs a pool of batch GDB
+## processes over the core files (one per CPU by default), demangles every
+## backtrace with a single SymbolMap loaded once from the binary, and prints
+## JSON grouped by crash signature.
+
+import std/[os, osproc, strutils, tables, json, re, algorithm, monotimes, times, strformat]
+import glob
+import symbol_map, mi_transformer
+
+type
+  TriageFrame* = object
+    level*: int
+    function*: string
+    args*: string
+    file*: string
+    line*: int
+    locals*: seq[(string, string)]
+
+  TriageThread* = object
+    id*: string
+    frames*: seq[TriageFrame]
+
+  CoreReport* = object
+    path*: string
+    signal*: string
+    current*: seq[TriageFrame]  # thread that was selected when the core was written
+    threads*: seq[TriageThread]
+
+  TriageOptions = object
+    gdbPath: string
+    binary: string
+    cores: seq[string]
+    jobs: int
+    depth: int
+    output: string
+
+const
+  CurrentMarker = "@@CURRENT"
+  AllMarker = "@@ALL"
+
+# "#1  0x000055d1 in foo__mod_u12 (x_p0=3) at /src/mod.nim:12"
+let reFrame = re"^#(\d+)\s+(?:0x[0-9a-fA-F]+ in )?(\S+) \((.*?)\)(?: (?:at|from) (.+?)(?::(\d+))?)?\s*$"
+let reThread = re"^Thread (\d+) "
+let reSignal = re"Program terminated with signal (\w+)"
+let reAssignment = re"\b([a-zA-Z_][a-zA-Z0-9_]*)="
+
+proc demangleAssignments(sm: SymbolMap, args: string): string =
+  ## Demangles the names in "x_p0=3, y_p1=0x0"
+  var matches: array[1, string]
+  var pos = 0
+  while true:
+    let bounds = findBounds(args, reAssignment, matches, start=pos)
+    if bounds.first == -1:
+      result.add(args[pos .. ^1])
+      break
+    result.add(args[pos ..< bounds.first])
+    result.add(demangleName(sm, matches[0]) & "=")
+    pos = bounds.last + 1
+
+proc framesOf(report: var CoreReport, thread: int): var seq[TriageFrame] =
+  if thread == -1:
+    return report.current
+  return report.threads[thread].frames
+
+proc parseBacktrace*(sm: SymbolMap, path, text: string): CoreReport =
+  ## Parses the batch GDB output produced for one core file
+  result.path = path
+  var inAll = false
+  var thread = -1  # -1 while reading the crashing thread's `bt`
+  var matches: array[5, string]
+
+  for rawLine in text.splitLines:
+    let line = rawLine.strip(leading = false)
+    if line == CurrentMarker:
+      inAll = false
+      thread = -1
+    elif line == AllMarker:
+      inAll = true
+    elif result.signal.len == 0 and find(line, reSignal, matches) != -1:
+      result.signal = matches[0]
+    elif inAll and match(line, reThread, matches):
+      result.threads.add(TriageThread(id: matches[0]))
+      thread = result.threads.high
+    elif match(line, reFrame, matches):
+      if inAll and thread == -1: continue
+      result.framesOf(thread).add(TriageFrame(
+        level: parseInt(matches[0]),
+        function: demangleName(sm, matches[1]),
+        args: demangleAssignments(sm, matches[2]),
+        file: matches[3],
+        line: (if matches[4].len > 0: parseInt(matches[4]) else: 0)
+      ))
+    elif line.len > 0 and line[0] in Whitespace and " = " in line and result.framesOf(thread).len > 0:
+      # `bt full` prints the locals of each frame indented below it
+      let eqPos = line.find(" = ")
+      let name = line[0 ..< eqPos].strip
+      result.framesOf(thread)[^1].locals.add((demangleName(sm, name), line[eqPos + 3 .. ^1]))
+
+proc signature*(report: CoreReport, depth: int): string =
+  ## Crash signature: signal plus the innermost `depth` functions of the
+  ## crashing thread
+  var names: seq[string] = @[]
+  for frame in report.current:
+    if frame.function == "??": continue
+    names.add(frame.function)
+    if names.len >= depth: break
+  let signal = if report.signal.len > 0: report.signal else: "unknown"
+  return signal & ": " & names.join(" <- ")
+
+proc toJson(frame: TriageFrame): JsonNode =
+  result = %*{"level": frame.level, "func": frame.function, "args": frame.args,
+              "file": frame.file, "line": frame.line}
+  var locals = newJObject()
+  for (name, value) in frame.locals:
+    locals[name] = %value
+  result["locals"] = locals
+
+proc toJson(report: CoreReport): JsonNode =
+  var current = newJArray()
+  for frame in report.current:
+    current.add(frame.toJson)
+  var threads = newJArray()
+  for thread in report.threads:
+    var frames = newJArray()
+    for frame in thread.frames:
+      frames.add(frame.toJson)
+    threads.add(%*{"id": thread.id, "frames": frames})
+  return %*{"core": report.path, "signal": report.signal, "backtrace": current, "threads": threads}
+
+proc gdbCommand(opts: TriageOptions, core, outFile: string): string =
+  let cmd = quoteShellCommand([opts.gdbPath, "-batch", "-nx", "-q",
+    "-ex", "set pagination off",
+    "-ex", "echo " & CurrentMarker & "\\n", "-ex", "bt",
+    "-ex", "echo " & AllMarker & "\\n", "-ex", "thread apply all bt full",
+    opts.binary, core])
+  return cmd & " > " & quoteShell(outFile) & " 2>&1"
+
+proc parseTriageArgs(args: seq[string]): TriageOptions =
+  let quotes = {'"', '\'', ' ', '`'}
+  result.gdbPath = findExe("gdb")
+  result.jobs = countProcessors()
+  result.depth = 5
+  var i = 0
+  while i < args.len:
+    let arg = args[i]
+    if arg == "--binary":
+      inc i
+      if i < args.len: result.binary = args[i].expandTilde
+    elif arg.startswith("--binary=") or arg.startswith("--binary:"):
+      result.binary = arg[9 .. ^1].strip(chars = quotes).expandTilde
+    elif arg.startswith("--gdb=") or arg.startswith("--gdb:"):
+      result.gdbPath = arg[6 .. ^1].strip(chars = quotes).expandTilde
+    elif arg.startswith("--jobs=") or arg.startswith("--jobs:"):
+      result.jobs = max(1, parseInt(arg[7 .. ^1]))
+    elif arg.startswith("--depth=") or arg.startswith("--depth:"):
+      result.depth = max(1, parseInt(arg[8 .. ^1]))
+    elif arg.startswith("--output=") or arg.startswith("--output:"):
+      result.output = arg[9 .. ^1].strip(chars = quotes).expandTilde
+    elif '*' in arg or '?' in arg:
+      # Shells on Windows do not expand globs for us
+      for path in walkGlob(arg.expandTilde):
+        result.cores.add(path)
+    else:
+      result.cores.add(arg.expandTilde)
+    inc i
+
+proc runTriage*(args: seq[string]): int =
+  var opts: TriageOptions
+  try:
+    opts = parseTriageArgs(args)
+  except ValueError as e:
+    stderr.writeLine("Invalid triage argument: " & e.msg)
+    return 1
+  if opts.binary.len == 0 or not fileExists(opts.binary):
+    stderr.writeLine("Usage: nim_debugger_mi triage --binary <program> [--jobs=N] [--depth=N] [--output=file.json] <core files>")
+    return 1
+  if opts.cores.len == 0:
+    stderr.writeLine("No core files given")
+    return 1
+
+  let start = getMonoTime()
+
+  # One symbol map for every worker's output
+  let sm = newSymbolMap()
+  discard sm.loadFromBinary(opts.binary)
+
+  let workDir = getTempDir() / ("nim_triage_" & $getCurrentProcessId())
+  createDir(workDir)
+  defer: removeDir(workDir)
+
+  var cmds: seq[string] = @[]
+  for i, core in opts.cores:
+    cmds.add(gdbCommand(opts, core, workDir / ($i & ".txt")))
+  discard execProcesses(cmds, options = {poEvalCommand}, n = opts.jobs)
+
+  var reports: seq[CoreReport] = @[]
+  var groups = initOrderedTable[string, seq[int]]()
+  for i, core in opts.cores:
+    let outFile = workDir / ($i & ".txt")
+    let text = if fileExists(outFile): readFile(outFile) else: ""
+    reports.add(parseBacktrace(sm, core, text))
+    groups.mgetOrPut(reports[^1].signature(opts.depth), @[]).add(i)
+
+  var ordered: seq[(string, seq[int])] = @[]
+  for sig, members in groups:
+    ordered.add((sig, members))
+  ordered.sort(proc(a, b: (string, seq[int])): int = cmp(b[1].len, a[1].len))
+
+  var groupsJson = newJArray()
+  for (sig, members) in ordered:
+    var cores = newJArray()
+    for i in members:
+      cores.add(reports[i].toJson)
+    groupsJson.add(%*{"signature": sig, "count": members.len, "cores": cores})
+
+  let elapsed = (getMonoTime() - start).inMilliseconds.float / 1000.0
+  let doc = %*{"binary": opts.binary, "cores": opts.cores.len, "groups": groupsJson}
+  if opts.output.len > 0:
+    writeFile(opts.output, pretty(doc, 2))
+  else:
+    stdout.writeLine(pretty(doc, 2))
+  stderr.writeLine(&"Triaged {opts.cores.len} cores into {ordered.len} groups in {elapsed:.2f}s " &
+                   &"with {opts.jobs} GDB workers")
+  return 0
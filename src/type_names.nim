@@ -0,0 +1,349 @@
+## Nim spellings for the C type names GDB prints in `type=` fields.
+##
+## `tySequence__9bAGqSvkAaXgMHvGvZtQtTw *`, `NimStringV2` and
+## `tyObject_FooObj__abc` become `seq[int]`, `string` and `FooObj`. The table
+## is built from the binary's DWARF type DIEs (via readelf) the first time a
+## Nim type is looked up, and resolved lazily, cached by DIE offset; names
+## DWARF does not cover fall back to pattern rules. Only Nim's own types are
+## renamed: C types and Nim's primitive typedefs (`NI`, `NU8`, ...) keep the
+## spelling GDB printed. Every full `type=` string is memoized, so repeated
+## types cost one table lookup per line.
+##
+## readelf runs in the background from `useBinary` on, and `pump` feeds its
+## output to the parser a slice at a time from the proxy's main loop. Until
+## the table is complete, Nim `type=` values pass through unchanged.
+
+import std/[tables, strutils, osproc, os]
+when defined(posix):
+  import std/posix
+else:
+  import std/streams
+
+type
+  TypeDie = object
+    tag: string        # DW_TAG_ without the prefix: "structure_type", "member", ...
+    name: string
+    target: int        # DW_AT_type offset, -1 if none
+    upper: int         # DW_AT_upper_bound of a subrange, -1 if none
+    members: seq[int]  # member / subrange children
+
+  TypeNames* = ref object
+    dies: Table[int, TypeDie]
+    byName: Table[string, int]    # C type name -> defining DIE offset
+    resolved: Table[int, string]  # DIE offset -> Nim spelling
+    memo: Table[string, string]   # full type= value -> Nim spelling
+    binaryPath: string            # DWARF source
+    reader: Process               # background readelf, nil when not reading
+    partial: string               # readelf output after its last complete line
+    loaded: bool
+    # Parser state while DWARF lines are fed in
+    parents: seq[int]
+    current: int
+
+const
+  KeptTags = ["base_type", "typedef", "pointer_type", "structure_type", "union_type",
+              "array_type", "subrange_type", "enumeration_type", "member",
+              "const_type", "volatile_type"]
+  # Nim's C typedefs for its primitive types
+  CBaseNames = {"NI": "int", "NI8": "int8", "NI16": "int16", "NI32": "int32", "NI64": "int64",
+                "NU": "uint", "NU8": "uint8", "NU16": "uint16", "NU32": "uint32", "NU64": "uint64",
+                "NF": "float", "NF32": "float32", "NF64": "float64",
+                "NIM_BOOL": "bool", "_Bool": "bool", "NIM_CHAR": "char",
+                "NimStringV2": "string", "NimStringDesc": "string"}.toTable
+
+proc newTypeNames*(): TypeNames =
+  new(result)
+  result.dies = initTable[int, TypeDie]()
+  result.byName = initTable[string, int]()
+  result.resolved = initTable[int, string]()
+  result.memo = initTable[string, string]()
+  result.current = -1
+
+# ----- Pattern rules -----
+
+proc stripHash(name: string): string =
+  ## "FooObj__abc" -> "FooObj"
+  let sep = name.rfind("__")
+  return if sep > 0: name[0 ..< sep] else: name
+
+proc patternBaseName(cName: string): string =
+  if CBaseNames.hasKey(cName):
+    return CBaseNames[cName]
+  if cName.startsWith("tySequence__"):
+    return "seq"
+  if cName.startsWith("tyObject_"):
+    let name = stripHash(cName["tyObject_".len .. ^1])
+    # `Foo = ref object` names its object type "Foo:ObjectType"
+    return name.replace("colonObjectType", ":ObjectType")
+  if cName.startsWith("tyEnum_"):
+    return stripHash(cName["tyEnum_".len .. ^1])
+  if cName.startsWith("tyTuple__"):
+    return "tuple"
+  if cName.startsWith("tyArray__"):
+    return "array"
+  if cName.startsWith("tyProc__"):
+    return "proc"
+  return cName
+
+proc pointerTo(inner, cInner: string): string =
+  ## Nim spelling of a pointer to a type spelled `inner` (C name `cInner`)
+  if inner == "string" or inner == "seq" or inner.startsWith("seq["):
+    return inner  # refc strings and seqs are pointers already
+  if inner.endsWith(":ObjectType"):
+    return inner[0 ..< inner.len - ":ObjectType".len]
+  if cInner.startsWith("tyObject_"):
+    return "ref " & inner
+  if cInner == "char" or cInner == "NIM_CHAR":
+    return "cstring"
+  return "ptr " & inner
+
+proc splitPointers(typ: string): tuple[base: string, pointers: int] =
+  var base = typ.strip()
+  var pointers = 0
+  while base.endsWith("*"):
+    inc pointers
+    base = base[0 ..< base.len - 1].strip()
+  return (base, pointers)
+
+proc patternTypeName*(typ: string): string =
+  ## Nim spelling from the shape of a C type name alone
+  let (base, pointers) = splitPointers(typ)
+  result = patternBaseName(base)
+  for i in 0 ..< pointers:
+    result = pointerTo(result, if i == 0: base else: "")
+
+# ----- DWARF table -----
+
+proc addDwarfLine(self: TypeNames, rawLine: string) =
+  ## One line of `readelf --debug-dump=info` output; only type DIEs are kept
+  let line = rawLine.strip(trailing = false)
+  if not line.startsWith("<"): return
+
+  if "Abbrev Number" in line:
+    # " <1><2d>: Abbrev Number: 2 (DW_TAG_structure_type)"
+    let close1 = line.find('>')
+    let close2 = line.find('>', close1 + 1)
+    if close1 < 0 or close2 < 0: return
+    var depth, offset: int
+    try:
+      depth = parseInt(line[1 ..< close1])
+      offset = parseHexInt(line[close1 + 2 ..< close2])
+    except ValueError:
+      return
+    self.parents.setLen(depth)
+    self.parents.add(offset)
+
+    let tagStart = line.find("(DW_TAG_")
+    let tag = if tagStart >= 0: line[tagStart + 8 ..< line.len - 1] else: ""
+    self.current = -1
+    if tag in KeptTags:
+      self.current = offset
+      self.dies[offset] = TypeDie(tag: tag, target: -1, upper: -1)
+      if tag in ["member", "subrange_type"] and depth > 0 and self.dies.hasKey(self.parents[depth - 1]):
+        self.dies[self.parents[depth - 1]].members.add(offset)
+    return
+
+  if self.current == -1: return
+  let current = self.current
+  let atStart = line.find("DW_AT_")
+  if atStart < 0: return
+  let colon = line.find(": ", atStart)
+  if colon < 0: return
+  let attr = line[atStart ..< colon].strip()
+  var value = line[colon + 2 .. ^1].strip()
+  case attr
+  of "DW_AT_name":
+    # "(indirect string, offset: 0x1c8): tySequence__..."
+    if value.startsWith("("):
+      let close = value.rfind("): ")
+      if close >= 0: value = value[close + 3 .. ^1]
+    self.dies[current].name = value
+    let tag = self.dies[current].tag
+    if tag notin ["member", "subrange_type"] and not self.byName.hasKey(value):
+      self.byName[value] = current
+  of "DW_AT_type":
+    try:
+      self.dies[current].target = parseHexInt(value.strip(chars = {'<', '>'}))
+    except ValueError:
+      discard
+  of "DW_AT_upper_bound":
+    try:
+      self.dies[current].upper = parseInt(value)
+    except ValueError:
+      discard
+  else:
+    discard
+
+proc loadFromDwarfDump*(self: TypeNames, dump: string) =
+  ## Parses `readelf --debug-dump=info` output, keeping type DIEs only
+  for line in dump.splitLines:
+    self.addDwarfLine(line)
+  self.parents.setLen(0)
+  self.current = -1
+  self.loaded = true
+
+proc finishReading(self: TypeNames) =
+  if self.partial.len > 0: self.addDwarfLine(self.partial)
+  self.partial.setLen(0)
+  self.parents.setLen(0)
+  self.current = -1
+  discard self.reader.waitForExit()
+  self.reader.close()
+  self.reader = nil
+  self.loaded = true
+
+proc useBinary*(self: TypeNames, binaryPath: string) =
+  ## Starts reading `binaryPath`'s DWARF in the background. Nim types are
+  ## declared at unit scope with their members one level down, so DIEs nested
+  ## deeper (locals in blocks, ...) are not even printed.
+  if self.reader != nil:
+    self.reader.terminate()
+    self.finishReading()
+  self.binaryPath = binaryPath
+  self.loaded = false
+  if not fileExists(binaryPath):
+    self.loaded = true
+    return
+  try:
+    self.reader = startProcess("readelf", args = ["--wide", "--dwarf-depth=3", "--debug-dump=info", binaryPath],
+                               options = {poUsePath, poStdErrToStdOut})
+  except OSError:
+    self.loaded = true
+
+proc pump*(self: TypeNames, budget: int = 256 * 1024): bool =
+  ## Parses up to `budget` bytes of what readelf has written so far, without
+  ## waiting for more; true once the table is complete
+  if self.loaded: return true
+  if self.reader == nil:
+    self.loaded = true  # no binary: pattern rules only
+    return true
+  when defined(posix):
+    var fds = [TPollfd(fd: self.reader.outputHandle.cint, events: POLLIN)]
+    var chunk: array[65536, char]
+    var consumed = 0
+    while consumed < budget and posix.poll(addr fds[0], 1, 0) > 0:
+      let n = posix.read(fds[0].fd, addr chunk[0], chunk.len)
+      if n <= 0:
+        self.finishReading()
+        return true
+      consumed += n
+      let start = self.partial.len
+      self.partial.setLen(start + n)
+      copyMem(addr self.partial[start], addr chunk[0], n)
+      var first = 0
+      var nl = self.partial.find('\n', start)
+      while nl >= 0:
+        self.addDwarfLine(self.partial[first ..< nl])
+        first = nl + 1
+        nl = self.partial.find('\n', first)
+      self.partial = self.partial[first .. ^1]
+    return false
+  else:
+    for line in self.reader.outputStream.lines:
+      self.addDwarfLine(line)
+    self.finishReading()
+    return true
+
+proc resolve(self: TypeNames, offset: int, depth: int = 0): string
+
+proc memberType(self: TypeNames, structOffset: int, name: string): int =
+  if not self.dies.hasKey(structOffset): return -1
+  for m in self.dies[structOffset].members:
+    if self.dies[m].name == name:
+      return self.dies[m].target
+  return -1
+
+proc pointee(self: TypeNames, offset: int): int =
+  ## Follows typedefs, qualifiers and one pointer level
+  var o = offset
+  for _ in 0 ..< 8:
+    if not self.dies.hasKey(o): return -1
+    case self.dies[o].tag
+    of "typedef", "const_type", "volatile_type": o = self.dies[o].target
+    of "pointer_type": return self.dies[o].target
+    else: return o
+  return -1
+
+proc seqElement(self: TypeNames, seqOffset: int, depth: int): string =
+  # refc: {Sup; data: T[]}; ARC/ORC: {len; p: ptr {cap; data: T[]}}
+  var data = self.memberType(seqOffset, "data")
+  if data == -1:
+    let content = self.pointee(self.memberType(seqOffset, "p"))
+    data = self.memberType(content, "data")
+  if data == -1 or not self.dies.hasKey(data): return "?"
+  if self.dies[data].tag == "array_type":
+    return self.resolve(self.dies[data].target, depth + 1)
+  return self.resolve(data, depth + 1)
+
+proc resolve(self: TypeNames, offset: int, depth: int = 0): string =
+  if self.resolved.hasKey(offset):
+    return self.resolved[offset]
+  if depth > 16 or not self.dies.hasKey(offset):
+    return "?"
+  let die = self.dies[offset]
+  case die.tag
+  of "base_type":
+    result = CBaseNames.getOrDefault(die.name, die.name)
+  of "typedef":
+    if CBaseNames.hasKey(die.name) or die.target == -1:
+      result = patternBaseName(die.name)
+    elif die.name.startsWith("ty"):
+      result = self.resolve(die.target, depth + 1)
+      if result == "?": result = patternBaseName(die.name)
+    else:
+      result = die.name
+  of "const_type", "volatile_type":
+    result = if die.target == -1: "void" else: self.resolve(die.target, depth + 1)
+  of "pointer_type":
+    if die.target == -1:
+      result = "pointer"
+    else:
+      let targetName = if self.dies.hasKey(die.target): self.dies[die.target].name else: ""
+      result = pointerTo(self.resolve(die.target, depth + 1), targetName)
+  of "structure_type", "union_type":
+    if die.name.startsWith("tySequence__") and not die.name.endsWith("_Content"):
+      result = "seq[" & self.seqElement(offset, depth) & "]"
+    elif die.name.startsWith("tyTuple__"):
+      var fields: seq[string] = @[]
+      for m in die.members:
+        fields.add(self.resolve(self.dies[m].target, depth + 1))
+      result = "(" & fields.join(", ") & ")"
+    else:
+      result = patternBaseName(die.name)
+  of "array_type":
+    let element = self.resolve(die.target, depth + 1)
+    var upper = -1
+    for m in die.members:
+      if self.dies[m].upper >= 0: upper = self.dies[m].upper
+    result = if upper >= 0: "array[" & $(upper + 1) & ", " & element & "]" else: "UncheckedArray[" & element & "]"
+  of "enumeration_type":
+    result = patternBaseName(die.name)
+  else:
+    result = die.name
+  self.resolved[offset] = result
+
+proc isNimType*(base: string): bool =
+  ## Types Nim generates (`tySequence__...`, `tyObject_...`, its string types);
+  ## C types and Nim's primitive typedefs are not renamed
+  return (base.len > 2 and base.startsWith("ty") and base[2] in {'A'..'Z'}) or
+         base in ["NimStringV2", "NimStringDesc"]
+
+proc nimTypeName*(self: TypeNames, typ: string): string =
+  ## Nim spelling of a `type=` value; C and unknown types are returned unchanged
+  if self.memo.hasKey(typ):
+    return self.memo[typ]
+  let (base, pointers) = splitPointers(typ)
+  if not isNimType(base):
+    self.memo[typ] = typ
+    return typ
+  if not self.pump():
+    return typ  # not memoized: resolved once the table is complete
+  if self.byName.hasKey(base):
+    result = self.resolve(self.byName[base])
+    for i in 0 ..< pointers:
+      result = pointerTo(result, if i == 0: base else: "")
+  else:
+    result = patternTypeName(typ)
+  if pointers == 0 and result == base:
+    result = typ  # keep GDB's exact spelling for types we do not know
+  self.memo[typ] = result
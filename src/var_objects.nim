@@ -0,0 +1,102 @@
+## Lifetime tracking and garbage collection for GDB variable objects.
+##
+## MIEngine creates var-objects on every stop and rarely deletes them, and
+## GDB re-evaluates every live one on `-var-update *`. The proxy learns each
+## object's name from its `-var-create` reply, notes the stop at which the IDE
+## last named it, and deletes root objects nobody has named for
+## `maxIdleStops` stops. The time GDB takes per `-var-update` is recorded so
+## the effect is visible.
+
+import std/[tables, sets, strutils, monotimes, times, algorithm]
+import mi_parser, internal_commands
+
+type
+  VarObjects* = ref object
+    commands: InternalCommands
+    maxIdleStops*: int               # 0 disables collection
+    stops: int
+    lastUsed: Table[string, int]     # root var-object -> stop at which it was last named
+    creating: HashSet[string]        # tokens of -var-create commands in flight
+    updateStarted: Table[string, MonoTime]
+    collected*: int
+    updates*: int
+    updateTime*: Duration
+    slowestUpdate*: Duration
+
+proc newVarObjects*(commands: InternalCommands, maxIdleStops: int = 0): VarObjects =
+  new(result)
+  result.commands = commands
+  result.maxIdleStops = maxIdleStops
+  result.lastUsed = initTable[string, int]()
+  result.creating = initHashSet[string]()
+  result.updateStarted = initTable[string, MonoTime]()
+
+proc live*(vo: VarObjects): int =
+  return vo.lastUsed.len
+
+proc rootOf(name: string): string =
+  ## "var3.field.[0]" -> "var3"; children die with their root
+  let dot = name.find('.')
+  return if dot == -1: name else: name[0 ..< dot]
+
+proc noteInput*(vo: VarObjects, line: string) =
+  ## Records var-object references in a command the IDE sends
+  let command = stripToken(line)
+  if not command.startsWith("-var-"): return
+  let token = miToken(line)
+  let args = miArgs(command)
+  if args.len == 0: return
+
+  case args[0]
+  of "-var-create":
+    if token.len > 0: vo.creating.incl(token)
+  of "-var-delete":
+    # "-var-delete [-c] name"; -c only deletes the children
+    if args.len >= 2 and args[1] != "-c" and '.' notin args[^1]:
+      vo.lastUsed.del(args[^1])
+  else:
+    if args[0] == "-var-update" and token.len > 0:
+      vo.updateStarted[token] = getMonoTime()
+    for arg in args[1 .. ^1]:
+      let root = rootOf(arg)
+      if vo.lastUsed.hasKey(root):
+        vo.lastUsed[root] = vo.stops
+
+proc collect(vo: VarObjects) =
+  var idle: seq[string] = @[]
+  for name, used in vo.lastUsed:
+    if vo.stops - used > vo.maxIdleStops:
+      idle.add(name)
+  idle.sort()
+  for name in idle:
+    vo.lastUsed.del(name)
+    discard vo.commands.send("-var-delete " & name)
+    inc vo.collected
+
+proc observe*(vo: VarObjects, line: string) =
+  ## Debugger output: learns created names, times updates and collects idle
+  ## objects when the inferior stops
+  if line.startsWith("*stopped"):
+    inc vo.stops
+    if vo.maxIdleStops > 0: vo.collect()
+    return
+  if not isResultRecord(line): return
+  let token = miToken(line)
+  if token.len == 0: return
+
+  if vo.creating.contains(token):
+    vo.creating.excl(token)
+    let name = miField(line, "name")
+    if not isErrorRecord(line) and name.len > 0:
+      vo.lastUsed[name] = vo.stops
+  elif vo.updateStarted.hasKey(token):
+    let elapsed = getMonoTime() - vo.updateStarted[token]
+    vo.updateStarted.del(token)
+    inc vo.updates
+    vo.updateTime += elapsed
+    if elapsed > vo.slowestUpdate: vo.slowestUpdate = elapsed
+
+proc summary*(vo: VarObjects): string =
+  let average = if vo.updates > 0: vo.updateTime.inMicroseconds div vo.updates else: 0
+  return "Var objects: " & $vo.live & " live, " & $vo.collected & " collected; -var-update: " &
+         $vo.updates & " calls, " & $average & " us avg, " & $vo.slowestUpdate.inMicroseconds & " us max"
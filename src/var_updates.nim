@@ -0,0 +1,92 @@
+## Coalescing of identical `-var-update` commands within a stop.
+##
+## IDEs often send the same `-var-update --all-values *` several times before
+## the inferior runs again. Nothing can change until the next `*running`, so
+## only the first one goes to the debugger; later copies wait for its reply
+## (or reuse it once it has arrived) and get it under their own token.
+## Commands that could change variable state end the coalescing window.
+
+import std/[tables, strutils]
+import mi_parser
+
+const
+  # IDE commands that cannot change what a -var-update reports
+  ReadOnlyCommands = ["-var-evaluate-expression", "-var-list-children", "-var-info-",
+                      "-var-show-", "-stack-list-", "-stack-info-", "-data-read-memory",
+                      "-data-list-register-", "-thread-info", "-break-list", "-complete",
+                      "-symbol-info-"]
+
+type
+  VarUpdates* = ref object
+    emit: proc(line: string) {.closure.}  # to the IDE, before output transformation
+    joinable: Table[string, string]       # command -> token sent to the debugger
+    keyOf: Table[string, string]          # sent token -> command
+    waiters: Table[string, seq[string]]   # sent token -> tokens answered with its reply
+    completed: Table[string, string]      # command -> reply without token, this stop
+    coalesced*: int
+
+proc newVarUpdates*(emit: proc(line: string) {.closure.}): VarUpdates =
+  new(result)
+  result.emit = emit
+  result.joinable = initTable[string, string]()
+  result.keyOf = initTable[string, string]()
+  result.waiters = initTable[string, seq[string]]()
+  result.completed = initTable[string, string]()
+
+proc invalidate*(vu: VarUpdates) =
+  ## Later updates go to the debugger again; waiters already queued still
+  ## get the reply they joined
+  vu.joinable.clear()
+  vu.completed.clear()
+
+proc handle*(vu: VarUpdates, line: string): bool =
+  ## Returns true if a -var-update was answered or queued behind an identical
+  ## one; false if `line` must be forwarded
+  let command = stripToken(line)
+  if not command.startsWith("-var-update"):
+    var readOnly = false
+    for prefix in ReadOnlyCommands:
+      if command.startsWith(prefix):
+        readOnly = true
+        break
+    if not readOnly: vu.invalidate()
+    return false
+
+  let token = miToken(line)
+  if token.len == 0: return false
+  let key = command.splitWhitespace().join(" ")
+  if vu.completed.hasKey(key):
+    inc vu.coalesced
+    vu.emit(token & vu.completed[key])
+    vu.emit("(gdb)")
+    return true
+  if vu.joinable.hasKey(key):
+    inc vu.coalesced
+    vu.waiters[vu.joinable[key]].add(token)
+    return true
+  vu.joinable[key] = token
+  vu.keyOf[token] = key
+  vu.waiters[token] = @[]
+  return false
+
+proc observe*(vu: VarUpdates, line: string) =
+  ## Debugger output: fans replies out to waiting tokens and ends the window
+  ## when the inferior resumes or stops
+  if line.startsWith("*running") or line.startsWith("*stopped"):
+    vu.invalidate()
+    return
+  if vu.keyOf.len == 0 or not isResultRecord(line): return
+  let token = miToken(line)
+  if not vu.keyOf.hasKey(token): return
+
+  let key = vu.keyOf[token]
+  let reply = stripToken(line)
+  if vu.joinable.getOrDefault(key) == token:
+    vu.joinable.del(key)
+    if not isErrorRecord(line):
+      vu.completed[key] = reply
+  for waiter in vu.waiters[token]:
+    vu.emit(waiter & reply)
+    vu.emit("(gdb)")
+  vu.waiters.del(token)
+  vu.keyOf.del(token)
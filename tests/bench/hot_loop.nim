@@ -0,0 +1,11 @@
+# Tight loop for tests/bench_conditions.nim: `hotStep` is hit once per
+# iteration and the benchmark's breakpoint condition never holds.
+
+var counter {.exportc.}: int
+
+proc hotStep() {.exportc, noinline.} =
+  inc counter
+
+for i in 0 ..< 20_000:
+  hotStep()
+echo counter
@@ -0,0 +1,39 @@
+## Conditional-breakpoint hit throughput, GDB-side vs target-side evaluation.
+##
+##   nimble bench
+##
+## Runs tests/bench/hot_loop under GDB with a breakpoint on `hotStep` whose
+## condition never holds, once with GDB evaluating it on every hit and once
+## with gdbserver evaluating it (what `--target-conditions` sets up).
+## Needs gdb and gdbserver on PATH.
+
+import std/[os, osproc, monotimes, times, strutils]
+
+const Hits = 20_000
+
+let dir = currentSourcePath().parentDir
+let program = dir / "bench" / "hot_loop"
+
+proc measure(label: string, setup: seq[string]) =
+  var args = @["-batch", "-nx"] & setup
+  args.add(@["-ex", "break hotStep if counter == -1", "-ex", "run", program])
+  let cmd = "gdb " & args.quoteShellCommand
+  let start = getMonoTime()
+  let (output, code) = execCmdEx(cmd)
+  let elapsed = (getMonoTime() - start).inNanoseconds.float / 1e9
+  if code != 0 or $Hits notin output:
+    echo label, ": failed (exit ", code, ")"
+    echo output
+    return
+  echo label, ": ", formatFloat(elapsed, ffDecimal, 2), " s, ",
+       formatFloat(Hits.float / elapsed, ffDecimal, 0), " hits/sec"
+
+if findExe("gdb").len == 0 or findExe("gdbserver").len == 0:
+  quit("bench_conditions needs gdb and gdbserver on PATH", 1)
+doAssert execCmd("nim c -d:release --debugger:native --hints:off " & quoteShell(dir / "bench" / "hot_loop.nim")) == 0
+
+measure("condition evaluated by gdb      ", @[])
+measure("condition evaluated by gdbserver", @[
+  "-ex", "set breakpoint condition-evaluation target",
+  "-ex", "target extended-remote | gdbserver --multi -",
+  "-ex", "set remote exec-file " & program])
@@ -0,0 +1,40 @@
+## Disassembly replies per second through the output transformer.
+##
+##   nimble bench
+##
+## Builds a 10k-instruction `-data-disassemble` reply spread over a few
+## functions, the shape VS Code's disassembly view requests while scrolling.
+
+import std/[monotimes, times, strutils]
+import symbol_map, mi_transformer
+
+const
+  Instructions = 10_000
+  Functions = 8
+  Iterations = 200
+
+proc buildReply(): string =
+  result = "^done,asm_insns=["
+  for i in 0 ..< Instructions:
+    if i > 0: result.add(",")
+    let fn = "process" & $(i mod Functions) & "__modA_u" & $(12 + i mod Functions)
+    result.add("{address=\"0x" & toHex(0x401000 + i * 4, 8) & "\",func-name=\"" & fn &
+               "\",offset=\"" & $(i * 4) & "\",inst=\"mov    %rsp,%rbp\"}")
+  result.add("]")
+
+let sm = newSymbolMap()
+for f in 0 ..< Functions:
+  sm.addGlobal("process" & $f & "__modA_u" & $(12 + f))
+let reply = buildReply()
+let transform = outputTransformer(dkGdb)
+
+var bytes = 0
+let start = getMonoTime()
+for _ in 0 ..< Iterations:
+  bytes += transform(reply, sm, false).len
+let elapsed = (getMonoTime() - start).inNanoseconds.float / 1e9
+
+echo "reply: ", Instructions, " instructions, ", reply.len, " bytes"
+echo "disassembly replies/sec: ", formatFloat(Iterations.float / elapsed, ffDecimal, 1)
+echo "instructions/sec: ", formatFloat(Iterations.float * Instructions.float / elapsed, ffDecimal, 0)
+doAssert bytes > 0
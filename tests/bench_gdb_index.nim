@@ -0,0 +1,48 @@
+## GDB cold-start time with and without a symbol index.
+##
+##   nimble bench
+##
+## Builds tests/bench/hot_loop with `--debugger:native`, writes the indexed
+## copy the proxy would cache for it, and times GDB loading the program and
+## resolving a line, once from the plain binary and once with `--symbols` on
+## the indexed copy. Small programs show little difference; pass a larger
+## binary as the first argument to measure a real service. Needs gdb on PATH.
+
+import std/[os, osproc, monotimes, times, strutils]
+import gdb_index
+
+const Runs = 5
+
+let dir = currentSourcePath().parentDir
+var program = dir / "bench" / "hot_loop"
+
+proc measure(label: string, args: seq[string]) =
+  var best = Inf
+  for _ in 1 .. Runs:
+    let cmd = "gdb " & (@["-batch", "-nx", "-ex", "info line main"] & args).quoteShellCommand
+    let start = getMonoTime()
+    let (output, code) = execCmdEx(cmd)
+    if code != 0:
+      echo label, ": failed (exit ", code, ")"
+      echo output
+      return
+    best = min(best, (getMonoTime() - start).inNanoseconds.float / 1e9)
+  echo label, ": ", formatFloat(best * 1000, ffDecimal, 1), " ms (best of ", Runs, ")"
+
+if findExe("gdb").len == 0:
+  quit("bench_gdb_index needs gdb on PATH", 1)
+if paramCount() >= 1:
+  program = absolutePath(paramStr(1))
+else:
+  doAssert execCmd("nim c -d:release --debugger:native --hints:off " & quoteShell(dir / "bench" / "hot_loop.nim")) == 0
+
+case indexState(program)
+of isNoDebugInfo: quit(program & " has no DWARF to index", 1)
+of isIndexed: quit(program & " already carries an index", 1)
+of isMissing: doAssert execCmd(indexCommand(program, findExe("gdb"))) == 0
+of isCached: discard
+let copy = indexedCopyPath(program)
+if not fileExists(copy): quit("could not build an index for " & program, 1)
+
+measure("without index", @[program])
+measure("with index   ", @["--exec=" & program, "--symbols=" & copy])
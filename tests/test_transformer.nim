@@ -1,6 +1,10 @@
 
-import unittest, strutils, tables, re
-import mi_transformer, symbol_map
+import unittest, strutils, tables, re, os
+import mi_transformer, symbol_map, mi_parser, internal_commands, sampling_profiler, triage, demangle_filter,
+       function_breakpoints, completion, symbol_search, type_names, memory_cache,
+       var_objects, var_updates, selection, async_records,
+       thread_states, runtime_skip, logpoints, target_conditions, symbol_service, gdb_pool, gdb_index,
+       debuginfo_rewrite, breakpoint_cache, build_id
 
 suite "MI Transformer Tests":
   setup:
@@ -44,3 +48,563 @@ suite "MI Transformer Tests":
     let output = transformInput(line, sm)
     echo "Input Transformed: ", output
     check output == expected
+
+  test "MI field extraction":
+    let line = """^done,threads=[{id="1",target-id="Thread 0x1 (LWP 7)",name="a\"b"},{id="2",target-id="Thread 0x2"}],current-thread-id="1""""
+    check miFields(line, "id") == @["1", "2"]
+    check miField(line, "name") == "a\"b"
+    check miField(line, "missing") == ""
+
+  test "Internal command replies are routed to the proxy":
+    var sent: seq[string] = @[]
+    var replied = ""
+    let commands = newInternalCommands(proc(line: string) = sent.add(line))
+    let token = commands.send("-thread-info", proc(reply: string) = replied = reply)
+    check sent == @[token & "-thread-info"]
+    check not commands.handleReply("1001^done")
+    check commands.handleReply(token & "^done,threads=[]")
+    check replied == token & "^done,threads=[]"
+    check commands.handleReply("(gdb)")
+    check not commands.handleReply("(gdb)")
+
+  test "Profiler interns identical stacks":
+    let prof = newProfiler(100, sm, newInternalCommands(proc(line: string) = discard))
+    prof.addSample(@["bar", "foo", "main"])
+    prof.addSample(@["bar", "foo", "main"])
+    prof.addSample(@["foo", "main"])
+    check prof.frameNames.len == 3
+    check prof.collapsed() == "main;foo 1\nmain;foo;bar 2\n"
+
+  test "Triage backtrace parsing and signature":
+    let text = """
+Program terminated with signal SIGSEGV, Segmentation fault.
+@@CURRENT
+#0  0x000055d1 in crash__app_u12 (x_p0=3) at /src/app.nim:12
+#1  0x000055d2 in main ()
+@@ALL
+
+Thread 1 (Thread 0x7f (LWP 42)):
+#0  0x000055d1 in crash__app_u12 (x_p0=3) at /src/app.nim:12
+        localVal_1 = 5
+#1  0x000055d2 in main ()
+No locals.
+"""
+    let report = parseBacktrace(sm, "core.1", text)
+    check report.signal == "SIGSEGV"
+    check report.current.len == 2
+    check report.current[0].function == "crash"
+    check report.current[0].args == "x=3"
+    check report.current[0].line == 12
+    check report.threads.len == 1
+    check report.threads[0].frames[0].locals == @[("localVal", "5")]
+    check report.signature(5) == "SIGSEGV: crash <- main"
+
+  test "Streaming demangle filter":
+    sm.addGlobal("mainVal__hello_u6")
+    let text = "#0 proc__mod_u12 (x_p0=1) at a.nim:3 mainVal__hello_u6=_ZN4test4mainE i_1 0x7f_ab"
+    check filterText(sm, text) == "#0 proc (x_p0=1) at a.nim:3 mainVal=test::main i_1 0x7f_ab"
+
+  test "Streaming demangle filter keeps split tokens whole":
+    var f = initDemangleFilter(sm)
+    var output = ""
+    let first = "call foo__m"
+    let consumed = f.scan(first, false, output)
+    check output == "call "
+    check consumed == 5
+    check f.scan(first[consumed .. ^1] & "od_u3;", true, output) == 12
+    check output == "call foo;"
+
+  test "Proc index covers every instantiation":
+    sm.addFunction("process__modA_u12")
+    sm.addFunction("process__modB_u98")
+    check sm.procInstances("process") == @["process__modA_u12", "process__modB_u98"]
+    check sm.procInstances("modB.process") == @["process__modB_u98"]
+    check nimModuleOf("process__modA_u12") == "modA"
+    # Nim 2 standard library modules carry their directory
+    check nimModuleOf("split__pureZstrutils_u1234") == "strutils"
+    check nimModuleOf("toHex__stdZprivateZdigitsutils_u5") == "digitsutils"
+    sm.addFunction("split__pureZstrutils_u1234")
+    check sm.procInstances("strutils.split") == @["split__pureZstrutils_u1234"]
+    # Nim 1.x: a hash, not a module; the proc is found by name only
+    check nimModuleOf("helper__9bAGqSvkAaXgMHvGvZtQtTw") == ""
+    sm.addFunction("helper__9bAGqSvkAaXgMHvGvZtQtTw")
+    check sm.procInstances("helper") == @["helper__9bAGqSvkAaXgMHvGvZtQtTw"]
+
+  test "Function breakpoint expands to hidden instantiations":
+    var sent: seq[string] = @[]
+    let commands = newInternalCommands(proc(line: string) = sent.add(line))
+    let bps = newFunctionBreakpoints(sm, commands)
+    sm.addFunction("process__modA_u12")
+    sm.addFunction("process__modB_u98")
+    check bps.expandInsert("1005-break-insert -f process") == "1005-break-insert -f process__modA_u12"
+    check bps.observe("1005^done,bkpt={number=\"3\"}") == "1005^done,bkpt={number=\"3\"}"
+    check sent.len == 1
+    check sent[0].endsWith("-break-insert -f process__modB_u98")
+    check commands.handleReply(miToken(sent[0]) & "^done,bkpt={number=\"4\"}")
+    check bps.observe("*stopped,reason=\"breakpoint-hit\",bkptno=\"4\"") == "*stopped,reason=\"breakpoint-hit\",bkptno=\"3\""
+    bps.mirror("1010-break-delete 3")
+    check sent[^1].endsWith("-break-delete 4")
+
+  test "Prefix trie":
+    var trie = initPrefixTrie()
+    for word in ["mainVal", "main", "mapIt", "other"]:
+      trie.insert(word)
+    trie.insert("main")
+    check trie.count == 4
+    check trie.withPrefix("ma", 10) == @["main", "mainVal", "mapIt"]
+    check trie.withPrefix("ma", 2) == @["main", "mainVal"]
+    check trie.withPrefix("x", 10).len == 0
+
+  test "Console completion ranks locals first":
+    sm.addGlobal("mainVal__hello_u6")
+    sm.addLocal("manual_1")
+    let completer = newCompleter(sm)
+    check completer.complete("1040-complete \"p ma\"") ==
+      "1040^done,completion=\"p ma\",matches=[\"p manual\",\"p mainVal\"],max_completions_reached=\"0\""
+    check completer.complete("1041-complete \"p obj.ma\"") == ""
+    check completer.complete("1042-complete \"br\"") == ""
+    check completer.complete("1043-complete \"info lo\"") == ""
+    check completer.complete("1044-complete \"p/x ma\"").startsWith("1044^done,completion=\"p/x ma\"")
+
+  test "Trigram symbol search":
+    check requiredLiterals("^proc(ess)?_[a-z]+x*yz") == @["proc", "_", "yz"]
+    check requiredLiterals("foo|bar").len == 0
+    sm.addFunction("process__modA_u12")
+    sm.addFunction("processAll__modB_u3")
+    sm.addGlobal("counter__modA_u7")
+    sm.addresses["process__modA_u12"] = "0x1139"
+    let search = newSymbolSearch(sm)
+    check search.query("^process$", functions = true).len == 1
+    check search.query("modA", functions = true).len == 1
+    check search.query("cess", functions = true).len == 2
+    check search.query("counter", functions = false).len == 1
+    # GDB regexes are POSIX basic
+    check breToPcre("^proc\\(ess\\)\\?_[a-z]\\+x*(yz)") == "^proc(ess)?_[a-z]+x*\\(yz\\)"
+    check breToPcre("a\\|^b$|*") == "a|^b\\$\\|*"
+    search.locations["0x1139"] = ("/src/modA.nim", 12)
+    check search.answer("12-symbol-info-functions --name \"^process$\"") ==
+      @["12^done,symbols={debug=[{filename=\"/src/modA.nim\",fullname=\"/src/modA.nim\"," &
+        "symbols=[{line=\"12\",name=\"process\"}]}]}"]
+    check search.answer("13-symbol-info-functions --type int").len == 0
+    sm.plainSymbols["main"] = true
+    sm.addresses["main"] = "0x1000"
+    inc sm.generation
+    check search.answer("14-symbol-info-functions --include-nondebug --name ^main$") ==
+      @["14^done,symbols={debug=[],nondebugging=[{address=\"0x1000\",name=\"main\"}]}"]
+    check search.answer("15-interpreter-exec console \"info functions ^main$\"")[^2] ==
+      "~\"0x1000  main\\n\""
+    check search.answer("16-interpreter-exec console \"info functions nothingLikeThis\"") ==
+      @["~\"All functions matching regular expression \\\"nothingLikeThis\\\":\\n\"", "16^done"]
+
+  test "Style-insensitive lookup":
+    sm.addGlobal("myVar__hello_u6")
+    sm.addLocal("loopCount_1")
+    check sm.getMangled("my_var", root = true) == "myVar__hello_u6"
+    check sm.getMangled("myvar", root = true) == "myVar__hello_u6"
+    check sm.getMangled("MyVar", root = true) == "MyVar"  # first letter is case-sensitive
+    check sm.getMangled("loop_count", root = true) == "loopCount_1"
+    check sm.getMangled("my_var") == "my_var"
+    check transformExpressionFor[dkGdb]("my_var.loop_count + obj->myvar", sm) == "myVar__hello_u6.loop_count + obj->myvar"
+    var reported: seq[string] = @[]
+    sm.styleCollisionHook = proc(name: string, spellings: seq[string]) = reported = spellings
+    sm.addGlobal("my_var__other_u9")
+    check sm.styleCollisions() == @[@["myVar", "my_var"]]
+    discard sm.getMangled("myvar", root = true)
+    check reported == @["myVar", "my_var"]
+
+  test "Mangling schemes are specialized per compiler":
+    check detectScheme(@["NimMain", "process__modA_u12"]) == msNim2
+    check detectScheme(@["NimMain", "helper__9bAGqSvk"]) == msNim1
+    check detectScheme(@["main"]) == msGeneric
+    check demangleAs[msNim2]("x_p0") == "x"
+    check demangleAs[msNim1]("x_p0") == "x_p0"
+    check demangleAs[msNim2]("helper__9bAGq") == "helper__9bAGq"
+    check demangleAs[msNim1]("helper__9bAGq") == "helper"
+    sm.setScheme(msNim2)
+    check sm.demangle("process__modA_u12") == "process"
+
+  test "Debugger-specialized input transformers":
+    sm.addLocal("localVal_1")
+    check transformInputFor[dkGdb]("-data-evaluate-expression \"localVal\"", sm) == "-data-evaluate-expression \"localVal_1\""
+    check inputTransformer(dkLldb)("-data-evaluate-expression \"localVal\"", sm, false) == "-data-evaluate-expression \"localVal_1\""
+    # lldb-mi matches `a.b` as one qualified name; a field access still mangles its base
+    check transformInputFor[dkGdb]("-data-evaluate-expression \"localVal.x\"", sm) == "-data-evaluate-expression \"localVal_1.x\""
+    check transformInputFor[dkLldb]("-data-evaluate-expression \"localVal.x\"", sm) == "-data-evaluate-expression \"localVal_1.x\""
+
+  test "Nim type names in type= fields":
+    check patternTypeName("NimStringV2") == "string"
+    check patternTypeName("NI") == "int"
+    check patternTypeName("tyObject_FooObj__abc") == "FooObj"
+    check patternTypeName("tyObject_FooObj__abc *") == "ref FooObj"
+    check patternTypeName("tyObject_FoocolonObjectType__abc *") == "Foo"
+    check patternTypeName("struct timeval") == "struct timeval"
+    # Nim 2 seq[int]: {len; p: ptr {cap; data: NI[]}}
+    sm.types.loadFromDwarfDump("""
+ <1><2d>: Abbrev Number: 2 (DW_TAG_typedef)
+    <2e>   DW_AT_name        : NI
+    <32>   DW_AT_type        : <0x38>
+ <1><38>: Abbrev Number: 3 (DW_TAG_base_type)
+    <3a>   DW_AT_name        : long int
+ <1><40>: Abbrev Number: 4 (DW_TAG_structure_type)
+    <41>   DW_AT_name        : (indirect string, offset: 0x10): tySequence__qwqHTkRvwhrRyENtudHQ7g
+ <2><45>: Abbrev Number: 5 (DW_TAG_member)
+    <46>   DW_AT_name        : len
+    <4a>   DW_AT_type        : <0x2d>
+ <2><4e>: Abbrev Number: 5 (DW_TAG_member)
+    <4f>   DW_AT_name        : p
+    <53>   DW_AT_type        : <0x60>
+ <2><57>: Abbrev Number: 0
+ <1><60>: Abbrev Number: 6 (DW_TAG_pointer_type)
+    <62>   DW_AT_type        : <0x68>
+ <1><68>: Abbrev Number: 4 (DW_TAG_structure_type)
+    <69>   DW_AT_name        : tySequence__qwqHTkRvwhrRyENtudHQ7g_Content
+ <2><6d>: Abbrev Number: 5 (DW_TAG_member)
+    <6e>   DW_AT_name        : cap
+    <72>   DW_AT_type        : <0x2d>
+ <2><76>: Abbrev Number: 5 (DW_TAG_member)
+    <77>   DW_AT_name        : data
+    <7b>   DW_AT_type        : <0x80>
+ <2><7f>: Abbrev Number: 0
+ <1><80>: Abbrev Number: 7 (DW_TAG_array_type)
+    <81>   DW_AT_type        : <0x2d>
+ <2><85>: Abbrev Number: 8 (DW_TAG_subrange_type)
+ <2><86>: Abbrev Number: 0
+""")
+    check sm.types.nimTypeName("tySequence__qwqHTkRvwhrRyENtudHQ7g") == "seq[int]"
+    check transformOutput("^done,name=\"var1\",numchild=\"2\",type=\"tySequence__qwqHTkRvwhrRyENtudHQ7g\"", sm) ==
+      "^done,name=\"var1\",numchild=\"2\",type=\"seq[int]\""
+    check transformOutput("^done,bkpt={number=\"1\",type=\"breakpoint\"}", sm) == "^done,bkpt={number=\"1\",type=\"breakpoint\"}"
+    # C types and Nim's primitive typedefs keep GDB's spelling
+    check sm.types.nimTypeName("NI") == "NI"
+    check transformOutput("^done,locals=[{name=\"s\",type=\"char *\"},{name=\"p\",type=\"int *\"}]", sm) ==
+      "^done,locals=[{name=\"s\",type=\"char *\"},{name=\"p\",type=\"int *\"}]"
+    # Only replies that describe variables are rewritten
+    check transformOutput("=cmd-param-changed,param=\"x\",type=\"tySequence__qwqHTkRvwhrRyENtudHQ7g\"", sm) ==
+      "=cmd-param-changed,param=\"x\",type=\"tySequence__qwqHTkRvwhrRyENtudHQ7g\""
+    # DWARF is read in the background; without it the pattern rules apply
+    let background = newTypeNames()
+    background.useBinary("/nonexistent/binary")
+    check background.pump()
+    check background.nimTypeName("NI") == "NI"
+    check background.nimTypeName("NimStringV2") == "string"
+    background.useBinary(getAppFilename())
+    while not background.pump(): sleep(1)
+    check background.nimTypeName("NimStringV2") == "string"
+
+  test "Disassembly func-name demangling":
+    sm.addGlobal("process__modA_u12")
+    let reply = "^done,asm_insns=[{address=\"0x1139\",func-name=\"process__modA_u12\",offset=\"0\",inst=\"push %rbp\"}," &
+                "{address=\"0x113a\",func-name=\"process__modA_u12\",offset=\"1\",inst=\"mov %rsp,%rbp\"}]"
+    check transformOutput(reply, sm) == reply.replace("process__modA_u12", "process")
+    check sm.localDemangledToMangled.len == 0  # func-name is not a local
+
+  test "Memory read cache":
+    var sent, emitted, forwarded: seq[string]
+    let commands = newInternalCommands(proc(line: string) = sent.add(line))
+    let mc = newMemoryCache(commands, proc(line: string) = emitted.add(line),
+                            proc(line: string) = forwarded.add(line))
+    check mc.handle("20-data-read-memory-bytes 0x1010 16")
+    check mc.busy
+    check sent == @["900000001-data-read-memory-bytes 0x0000000000001000 4096"]
+    check commands.handleReply("900000001^done,memory=[{begin=\"0x0000000000001000\",offset=\"0x0000000000000000\"," &
+                               "end=\"0x0000000000002000\",contents=\"" & "ab".repeat(PageSize) & "\"}]")
+    check not mc.busy
+    check emitted[0] == "20^done,memory=[{begin=\"0x0000000000001010\",offset=\"0x0000000000000000\"," &
+                        "end=\"0x0000000000001020\",contents=\"" & "ab".repeat(16) & "\"}]"
+    # Overlapping read: served locally
+    check mc.handle("21-data-read-memory-bytes 0x1000 32")
+    check sent.len == 1 and mc.hits == 1
+    # Block offsets are relative to address + -o, as in GDB
+    check mc.handle("25-data-read-memory-bytes -o 16 0x1000 4")
+    check emitted[^2] == "25^done,memory=[{begin=\"0x0000000000001010\",offset=\"0x0000000000000000\"," &
+                         "end=\"0x0000000000001014\",contents=\"abababab\"}]"
+    # Two adjacent missing pages are merged into one read
+    check mc.handle("22-data-read-memory-bytes 0x1ff0 8192")
+    check sent[^1] == "900000002-data-read-memory-bytes 0x0000000000002000 8192"
+    # Failed fills fall back to the debugger; resumes drop the cache
+    check commands.handleReply("900000002^error,msg=\"Cannot access memory\"")
+    check forwarded == @["22-data-read-memory-bytes 0x1ff0 8192"]
+    mc.observe("*running,thread-id=\"all\"")
+    check mc.handle("23-data-read-memory-bytes 0x1000 16")
+    check sent.len == 3
+    check commands.handleReply("900000003^done,memory=[{begin=\"0x0000000000001000\",offset=\"0x0000000000000000\"," &
+                               "end=\"0x0000000000002000\",contents=\"" & "cd".repeat(PageSize) & "\"}]")
+    check mc.handle("26-data-read-memory-bytes 0x1000 16") and sent.len == 3
+    # Variable objects may call procs that write memory
+    check mc.noteCommand("27-var-create - * \"bump(counter)\"")
+    check not mc.noteCommand("28-stack-list-frames")
+    check mc.handle("29-data-read-memory-bytes 0x1000 16") and sent.len == 4
+    check not mc.handle("24-data-read-memory-bytes &buf 16")
+
+  test "Stale var-object collection":
+    var sent: seq[string]
+    let vo = newVarObjects(newInternalCommands(proc(line: string) = sent.add(line)), maxIdleStops = 1)
+    vo.noteInput("30-var-create - * \"x\"")
+    vo.observe("30^done,name=\"var1\",numchild=\"0\",value=\"1\",type=\"NI\"")
+    vo.noteInput("31-var-create - * \"y\"")
+    vo.observe("31^done,name=\"var2\",numchild=\"0\",value=\"2\",type=\"NI\"")
+    check vo.live == 2
+    vo.observe("*stopped,reason=\"end-stepping-range\"")
+    vo.noteInput("32-var-evaluate-expression var1.field")
+    vo.observe("*stopped,reason=\"end-stepping-range\"")
+    check sent == @["900000001-var-delete var2"]
+    check vo.live == 1
+    vo.noteInput("33-var-update --all-values *")
+    vo.observe("33^done,changelist=[]")
+    check vo.updates == 1
+
+  test "Identical -var-update coalescing":
+    var emitted: seq[string]
+    let vu = newVarUpdates(proc(line: string) = emitted.add(line))
+    check not vu.handle("40-var-update --all-values *")
+    check vu.handle("41-var-update  --all-values *")
+    vu.observe("40^done,changelist=[{name=\"var1\",value=\"2\"}]")
+    check emitted == @["41^done,changelist=[{name=\"var1\",value=\"2\"}]", "(gdb)"]
+    check vu.handle("42-var-update --all-values *")
+    check emitted[2] == "42^done,changelist=[{name=\"var1\",value=\"2\"}]"
+    check not vu.handle("43-var-list-children var1") and vu.handle("44-var-update --all-values *")
+    check not vu.handle("45-var-assign var1 3")
+    check not vu.handle("46-var-update --all-values *")
+    vu.observe("*running,thread-id=\"all\"")
+    check not vu.handle("47-var-update var1")
+    check vu.coalesced == 3
+
+  test "Thread and frame selection tracking":
+    var sent, emitted: seq[string]
+    let s = newSelection(newInternalCommands(proc(line: string) = sent.add(line)),
+                         proc(line: string) = emitted.add(line))
+    s.observe("*stopped,reason=\"breakpoint-hit\",thread-id=\"2\",stopped-threads=\"all\"")
+    check s.rewrite("50-thread-select 2") == "50-thread-select 2"
+    s.observe("50^done,new-thread-id=\"2\",frame={level=\"0\",func=\"main\"}")
+    check s.rewrite("49-stack-info-depth") == "49-stack-info-depth --thread 2 --frame 0"
+    s.observe("49^done,depth=\"5\"")
+    # Redundant select and frame select are answered locally
+    check s.rewrite("51-thread-select 2") == ""
+    check s.rewrite("52-stack-select-frame 3") == ""
+    check emitted == @["51^done,new-thread-id=\"2\",frame={level=\"0\",func=\"main\"}", "(gdb)", "52^done", "(gdb)"]
+    check s.rewrite("53-stack-list-variables --all-values") == "53-stack-list-variables --thread 2 --frame 3 --all-values"
+    check s.rewrite("54-var-update --all-values *") == "54-var-update --all-values *"
+    check sent.len == 0
+    # Commands relying on GDB's selection get the frame selected first
+    check s.rewrite("55-interpreter-exec console \"up\"") == "55-interpreter-exec console \"up\""
+    check sent == @["900000001-stack-select-frame 3"]
+    check s.rewrite("56-thread-select 2") == ""
+    check emitted[^2] == "56^done,new-thread-id=\"2\""  # its frame is no longer the selected one
+    check s.rewrite("57-stack-list-variables --all-values") == "57-stack-list-variables --thread 2 --frame 3 --all-values"
+    check s.dropped == 3
+    # Frames past the known depth go to GDB, which may reject them
+    check s.rewrite("58-stack-select-frame 9") == "58-stack-select-frame 9"
+    s.observe("58^error,msg=\"No frame at level 9.\"")
+    check s.rewrite("59-stack-list-locals 1") == "59-stack-list-locals --thread 2 --frame 3 1"
+
+  test "Async notification flood control":
+    var emitted: seq[string]
+    let ar = newAsyncRecords(proc(line: string) = emitted.add(line), windowMs = 1000)
+    check ar.observe("=thread-created,id=\"2\",group-id=\"i1\"")
+    check ar.observe("=thread-created,id=\"3\",group-id=\"i1\"")
+    check ar.observe("=thread-exited,id=\"2\",group-id=\"i1\"")
+    check ar.observe("=breakpoint-modified,bkpt={number=\"1\",times=\"1\"}")
+    check ar.observe("~\"tick\\n\"") == false
+    check ar.observe("=breakpoint-modified,bkpt={number=\"1\",times=\"2\"}")
+    check emitted.len == 0
+    check ar.observe("*stopped,reason=\"breakpoint-hit\"") == false
+    check emitted == @["=thread-created,id=\"3\",group-id=\"i1\"",
+                       "=breakpoint-modified,bkpt={number=\"1\",times=\"2\"}"]
+    check ar.suppressed["thread"] == 2
+    check ar.suppressed["breakpoint-modified"] == 1
+
+  test "Non-stop thread states and per-thread locals":
+    let ts = newThreadStates(nonStop = true)
+    ts.observe("=thread-created,id=\"1\",group-id=\"i1\"")
+    ts.observe("=thread-created,id=\"2\",group-id=\"i1\"")
+    ts.observe("*running,thread-id=\"all\"")
+    ts.observe("*stopped,reason=\"breakpoint-hit\",thread-id=\"2\",stopped-threads=[\"2\"]")
+    check ts.isRunning("1") and not ts.isRunning("2")
+    check ts.anyRunning
+    check ts.rewrite("60-exec-interrupt") == "60-exec-interrupt --all"
+    check ts.rewrite("61-exec-interrupt --thread 1") == "61-exec-interrupt --thread 1"
+    sm.useLocalScope("2")
+    sm.addLocal("counter_1")
+    sm.useLocalScope("1")
+    check sm.getMangled("counter") == "counter"
+    sm.useLocalScope("2")
+    check sm.getMangled("counter") == "counter_1"
+
+  test "Nim runtime step-skipping":
+    var sent, emitted: seq[string]
+    let commands = newInternalCommands(proc(line: string) = sent.add(line))
+    sm.addFunction("rawAlloc__system_u4711")
+    let rs = newRuntimeSkip(sm, commands, proc(line: string) = emitted.add(line))
+    check rs.skipRules()[^1] == "skip -rfunction __(system)_u[0-9]+$"
+    check rs.install() == 4
+    check rs.install() == 0
+    check rs.isRuntime("nimDecRefIsLast") and rs.isRuntime("eqdestroy___system_u12")
+    check not rs.isRuntime("process__modA_u12")
+    sent.setLen(0)
+    rs.noteInput("70-exec-step")
+    check rs.observe("*stopped,reason=\"end-stepping-range\",frame={func=\"nimDecRefIsLast\"},thread-id=\"1\"") == ""
+    check sent == @["900000005-exec-finish --thread 1"]
+    check rs.observe("*running,thread-id=\"all\"") == ""
+    # finish stops mid-line; the IDE's step takes it to the next line
+    check rs.observe("*stopped,reason=\"function-finished\",frame={func=\"process__modA_u12\"},thread-id=\"1\"") == ""
+    check sent[^1] == "900000006-exec-step"
+    check rs.observe("*running,thread-id=\"all\"") == ""
+    check rs.observe("*stopped,reason=\"end-stepping-range\",frame={func=\"process__modA_u12\"},thread-id=\"1\"") ==
+      "*stopped,reason=\"end-stepping-range\",frame={func=\"process__modA_u12\"},thread-id=\"1\""
+    check rs.finishes == 1
+
+  test "Logpoints via dprintf":
+    var emitted, sent: seq[string]
+    sm.addFunction("process__modA_u12")
+    sm.addFunction("process__modB_u98")
+    sm.addLocal("count_1")
+    let lp = newLogpoints(sm, proc(line: string) = emitted.add(line))
+    let bps = newFunctionBreakpoints(sm, newInternalCommands(proc(line: string) = sent.add(line)))
+    let inserted = lp.rewrite("80-dprintf-insert -c \"count > 3\" process \"n=%d\\n\" count")
+    check inserted == "80-dprintf-insert -c \"count_1 > 3\" process \"n=%d\\n\" \"count_1\""
+    check bps.expandInsert(inserted) == "80-dprintf-insert -c \"count_1 > 3\" process__modA_u12 \"n=%d\\n\" \"count_1\""
+    check bps.observe("80^done,bkpt={number=\"2\"}") == "80^done,bkpt={number=\"2\"}"
+    check sent.len == 1 and sent[0].endsWith("-dprintf-insert -c \"count_1 > 3\" process__modB_u98 \"n=%d\\n\" \"count_1\"")
+    check lp.rewrite("81-interpreter-exec console \"dprintf modA.process,\\\"v=%d, %s\\\\n\\\",count,f(count, 1)\"") ==
+      "81-dprintf-insert modA.process \"v=%d, %s\\\\n\" \"count_1\" \"f(count_1, 1)\""
+    check lp.rewrite("82-break-insert main") == "82-break-insert main"
+    check not lp.observe("*running,thread-id=\"all\"")
+    check lp.observe("~\"n=4\\n\"")
+    check lp.observe("~\"v=5, in process__modA_u12\\n\"")
+    check not lp.observe("=breakpoint-modified,bkpt={number=\"2\",times=\"2\"}")
+    check emitted.len == 0
+    check not lp.observe("~\"program output\\n\"")
+    check emitted == @["~\"n=4\\nv=5, in process\\n\""]
+    check lp.observe("~\"n=5\\n\"")
+    check not lp.observe("*stopped,reason=\"signal-received\"")
+    check emitted.len == 2
+
+  test "Target-side breakpoint conditions":
+    check nimConditionToC("i mod 7 == 0 and not done") == "i % 7 == 0 && ! done"
+    check nimConditionToC("name == \"and\" or p == nil") == "name == \"and\" || p == 0"
+    check nimConditionToC("obj.xor > 1") == "obj.xor > 1"
+    var sent: seq[string]
+    let tc = newTargetConditions(newInternalCommands(proc(line: string) = sent.add(line)),
+                                 "/usr/bin/gdbserver", "", proc(message: string) = discard)
+    check tc.rewrite("90-break-condition 2 i > 3 and j < 4") == "90-break-condition 2 i > 3 && j < 4"
+    check tc.rewrite("91-break-insert -f -c \"x mod 2 == 1\" loop.nim:12") == "91-break-insert -f -c \"x % 2 == 1\" loop.nim:12"
+    discard tc.rewrite("92-file-exec-and-symbols /tmp/app")
+    check tc.rewrite("93-exec-run") == "93-exec-run"
+    check sent == @["900000001-gdb-set breakpoint condition-evaluation target",
+                    "900000002-interpreter-exec console \"target extended-remote | /usr/bin/gdbserver --multi -\"",
+                    "900000003-gdb-set remote exec-file \"/tmp/app\""]
+
+  test "Symbol snapshot round trip":
+    sm.setScheme(msNim2)
+    sm.addFunction("process__modA_u12")
+    sm.addGlobal("counter__modA_u3")
+    sm.addresses["process__modA_u12"] = "0x401000"
+    let path = getTempDir() / "nim_debugger_mi_test.syms"
+    sm.saveSnapshot(path)
+    defer: removeFile(path)
+    let loaded = newSymbolMap()
+    check loaded.loadFromSnapshot(path)
+    check loaded.scheme == msNim2
+    check loaded.globalMangledToDemangled == sm.globalMangledToDemangled
+    check loaded.procInstances("modA.process") == @["process__modA_u12"]
+    check loaded.procInstances("counter").len == 0
+    check loaded.addresses == sm.addresses
+    check loaded.getMangled("counter") == "counter__modA_u3"
+    check not newSymbolMap().loadFromSnapshot(path & ".missing")
+
+  test "Service sockets in a private runtime directory":
+    let dir = runtimeDir()
+    check getFilePermissions(dir) == {fpUserRead, fpUserWrite, fpUserExec}
+    check defaultSocketPath().parentDir == dir
+    let planted = getTempDir() / "nim_debugger_mi_not_a_socket"
+    writeFile(planted, "")
+    defer: removeFile(planted)
+    check not trustedSocket(planted)
+    check requestSnapshot(planted, "/bin/true") == ""
+    check not isElfFile(planted)
+    expect IOError:
+      discard buildSnapshot(planted & ";touch " & planted & ".pwned")
+    check not fileExists(planted & ".pwned")
+
+  test "Warm GDB handover marker":
+    let marker = warmMarker("/srv/build dir/server")
+    check marker.startsWith(WarmMarker & ",")
+    check miField(marker, "binary") == "/srv/build dir/server"
+
+  test "GDB index companion":
+    let binary = getTempDir() / "nim_debugger_mi_index_test"
+    writeFile(binary, "not an ELF file")
+    defer: removeFile(binary)
+    check indexState(binary) == isNoDebugInfo
+    let copy = indexedCopyPath(binary)
+    check copy.endsWith(".debug")
+    check useIndexedCopy(@["--interpreter=mi", binary], binary) ==
+      @["--interpreter=mi", "--exec=" & binary, "--symbols=" & copy]
+    check indexCommand(binary, "/usr/bin/gdb").contains("gdb-add-index")
+
+  test "Rewrite DWARF names in place":
+    sm.setScheme(msNim2)
+    sm.addFunction("process__modA_u12")
+    let dump = """
+ <1><2d>: Abbrev Number: 5 (DW_TAG_subprogram)
+    <2e>   DW_AT_name        : (indirect string, offset: 0x0): process__modA_u12
+ <2><40>: Abbrev Number: 6 (DW_TAG_formal_parameter)
+    <41>   DW_AT_name        : (indirect string, offset: 0x12): count_p0
+ <2><50>: Abbrev Number: 7 (DW_TAG_variable)
+    <51>   DW_AT_name        : (indirect string, offset: 0x1b): FR_
+ <1><60>: Abbrev Number: 8 (DW_TAG_base_type)
+    <61>   DW_AT_name        : (indirect string, offset: 0x1f): NI
+"""
+    let (names, referenced) = collectNameRefs(dump)
+    check names.len == 3
+    check referenced == @[0x0, 0x12, 0x1b, 0x1f]
+    let rewrites = planRewrites(sm, names, referenced)
+    check rewrites == @[(0x0, "process"), (0x12, "count")]
+    # A reference into the tail of a string keeps it mangled
+    check planRewrites(sm, names, referenced & @[0x17]) == @[(0x0, "process")]
+
+    var section = "process__modA_u12\0count_p0\0FR_\0NI\0"
+    var byOffset = initTable[int, string]()
+    for r in names: byOffset[r.offset] = r.name
+    check applyRewrites(cast[ptr UncheckedArray[char]](addr section[0]), 0, byOffset, rewrites).len == 2
+    check section == "process\0\0\0\0\0\0\0\0\0\0\0count\0\0\0\0FR_\0NI\0"
+
+  test "Breakpoint locations cached by build-id":
+    let path = getTempDir() / "nim_debugger_mi_test_breakpoints.tsv"
+    defer: removeFile(path)
+    let first = newBreakpointCache(path)
+    check first.rewrite("10-break-insert -f /src/app.nim:12", "10-break-insert -f /src/app.nim:12") == "10-break-insert -f /src/app.nim:12"
+    check first.observe("10^done,bkpt={number=\"1\",type=\"breakpoint\",addr=\"0x0000000000401136\"," &
+                        "original-location=\"/src/app.nim:12\"}").len > 0
+    check first.rewrite("11-break-insert process", "11-break-insert process__modA_u12") == "11-break-insert process__modA_u12"
+    discard first.observe("11^done,bkpt={number=\"2\",addr=\"<MULTIPLE>\"}")
+    check first.rewrite("12-break-insert tick", "12-break-insert tick__app_u3") == "12-break-insert tick__app_u3"
+    discard first.observe("12^done,bkpt={number=\"3\",addr=\"0x0000000000401200\"}")
+    check first.rewrite("13-break-insert --source app.nim --line 14", "13-break-insert --source app.nim --line 14") ==
+      "13-break-insert --source app.nim --line 14"
+    discard first.observe("13^done,bkpt={number=\"4\",addr=\"0x0000000000401300\"}")
+    check first.learned == 2
+    discard first.observe("*running,thread-id=\"all\"")
+
+    let next = newBreakpointCache(path)
+    check next.rewrite("20-break-insert -f /src/app.nim:12", "20-break-insert -f /src/app.nim:12") == "20-break-insert -f *0x0000000000401136"
+    check next.rewrite("21-break-insert process", "21-break-insert process__modA_u12") == "21-break-insert process__modA_u12"
+    check next.rewrite("22-break-insert tick", "22-break-insert tick__app_u3") == "22-break-insert *0x0000000000401200"
+    check next.observe("22^done,bkpt={number=\"3\",original-location=\"*0x0000000000401200\"}") ==
+      "22^done,bkpt={number=\"3\",original-location=\"tick\"}"
+    check next.observe("20^done,bkpt={number=\"1\",addr=\"0x0000000000401136\"," &
+                       "original-location=\"*0x0000000000401136\"}") ==
+      "20^done,bkpt={number=\"1\",addr=\"0x0000000000401136\",original-location=\"/src/app.nim:12\"}"
+    check next.hits == 2
+
+  test "PIE breakpoint addresses are not cached":
+    check isFixedAddress("ELF Header:\n  Type:                              EXEC (Executable file)\n")
+    check not isFixedAddress("ELF Header:\n  Type:                              DYN (Position-Independent Executable file)\n")
+    check not isFixedAddress("not an ELF file")
+    # What a PIE gets: its pre-run addresses are unrelocated, so nothing is reused
+    let pie = newBreakpointCache("")
+    check pie.rewrite("30-break-insert /src/app.nim:12", "30-break-insert /src/app.nim:12") == "30-break-insert /src/app.nim:12"
+    check pie.observe("30^done,bkpt={number=\"1\",addr=\"0x0000000000001136\",original-location=\"/src/app.nim:12\"}") ==
+      "30^done,bkpt={number=\"1\",addr=\"0x0000000000001136\",original-location=\"/src/app.nim:12\"}"
+    check pie.rewrite("31-break-insert /src/app.nim:12", "31-break-insert /src/app.nim:12") == "31-break-insert /src/app.nim:12"
+    check pie.learned == 0